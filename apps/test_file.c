@@ -3,6 +3,7 @@
 //
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../io/File.h"
 #include "../disk/disk.h"
@@ -137,6 +138,676 @@ const char *test_fwrite() {
     return 0;
 }
 
+// Shrink a file reaching into the double indirect blocks back down through every level
+const char *test_ftruncate() {
+    FILE *test_file = fopen("./data_files/classes.xml", "r");
+    if (test_file == NULL) return "Error Opening Test File";
+
+    const int size = BLOCK_SIZE * 140 + 10;
+    int sizes[] = {
+            BLOCK_SIZE * 139 + 7,   // Keep part of the double indirect
+            BLOCK_SIZE * 20,        // Release the double indirect
+            BLOCK_SIZE * 3 + 100,   // Release the single indirect
+            0                       // Release everything
+    };
+
+    char *buffer = (char *) calloc(size, sizeof(char));
+    char *file_data = (char *) calloc(size, sizeof(char));
+    if (buffer == NULL || file_data == NULL) return llfs_strerror(MEMORY_ALLOC_ERROR);
+
+    size_t read = fread(buffer, sizeof(char), size, test_file);
+    fclose(test_file);
+    unit_assert("Error Reading Bytes From File", read == size);
+
+    llfs_file *file;
+    llfs_error e = llfs_touch("/trunc.c");
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_fopen("/trunc.c", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_fwrite(buffer, sizeof(char), size, file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_ftruncate(file, size + 1);
+    unit_assert(llfs_strerror(e), e == BYTE_OUT_OF_RANGE_ERROR);
+
+    for (int j = 0; j < sizeof(sizes) / sizeof(int); j++) {
+        e = llfs_ftruncate(file, sizes[j]);
+        unit_assert(llfs_strerror(e), e == 0);
+
+        // Reopen so the data is read back from the disk
+        e = llfs_fclose(file);
+        unit_assert(llfs_strerror(e), e == 0);
+        e = llfs_fopen("/trunc.c", &file);
+        unit_assert(llfs_strerror(e), e == 0);
+
+        e = llfs_fread(file_data, sizeof(char), sizes[j], file);
+        unit_assert(llfs_strerror(e), e == 0);
+        unit_assert("Truncated Data Did Not Match", memcmp(file_data, buffer, sizes[j]) == 0);
+
+        e = llfs_fread(file_data, sizeof(char), 1, file);
+        unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+    }
+
+    // The released blocks can be used to grow the file again
+    e = llfs_fwrite(buffer, sizeof(char), BLOCK_SIZE * 12, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fseek(file, LLFS_FSEEK_START, 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(file_data, sizeof(char), BLOCK_SIZE * 12, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Regrown Data Did Not Match", memcmp(file_data, buffer, BLOCK_SIZE * 12) == 0);
+
+    e = llfs_fclose(file);
+    free(buffer);
+    free(file_data);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_rm("/trunc.c", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_fadvise() {
+    FILE *test_file = fopen("./data_files/classes.xml", "r");
+    if (test_file == NULL) return "Error Opening Test File";
+
+    const int size = BLOCK_SIZE * 30 + 20;
+    char *buffer = (char *) calloc(size, sizeof(char));
+    char *file_data = (char *) calloc(size, sizeof(char));
+    if (buffer == NULL || file_data == NULL) return llfs_strerror(MEMORY_ALLOC_ERROR);
+
+    size_t read = fread(buffer, sizeof(char), size, test_file);
+    fclose(test_file);
+    unit_assert("Error Reading Bytes From File", read == size);
+
+    llfs_file *file;
+    llfs_error e = llfs_touch("/advise.c");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/advise.c", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fwrite(buffer, sizeof(char), size, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_fopen("/advise.c", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_fadvise(file, 0, 0, LLFS_FADV_SEQUENTIAL);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(file_data, sizeof(char), size, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Sequential Data Did Not Match", memcmp(file_data, buffer, size) == 0);
+
+    // Released blocks are read again when they are accessed
+    e = llfs_fadvise(file, 0, 0, LLFS_FADV_DONTNEED);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fadvise(file, 0, 0, LLFS_FADV_RANDOM);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fseek(file, LLFS_FSEEK_SET, BLOCK_SIZE * 12 + 3);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(file_data, sizeof(char), BLOCK_SIZE * 2, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Random Data Did Not Match", memcmp(file_data, buffer + BLOCK_SIZE * 12 + 3, BLOCK_SIZE * 2) == 0);
+
+    e = llfs_fadvise(file, BLOCK_SIZE * 20, BLOCK_SIZE * 5, LLFS_FADV_WILLNEED);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fseek(file, LLFS_FSEEK_SET, BLOCK_SIZE * 20);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(file_data, sizeof(char), size - BLOCK_SIZE * 20, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Prefetched Data Did Not Match", memcmp(file_data, buffer + BLOCK_SIZE * 20, size - BLOCK_SIZE * 20) == 0);
+
+    e = llfs_fadvise(file, 0, 0, (llfs_fadvise_opt) 10);
+    unit_assert(llfs_strerror(e), e == INVALID_OPTION_ERROR);
+
+    e = llfs_fclose(file);
+    free(buffer);
+    free(file_data);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_rm("/advise.c", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+// Write header and payload records from separate buffers and read them back the same way
+const char *test_vectored() {
+    const int num_records = 20;
+    char header[16], payload[200], read_header[16], read_payload[200];
+
+    llfs_file *file;
+    llfs_error e = llfs_touch("/records.db");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/records.db", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    for (int i = 0; i < num_records; i++) {
+        snprintf(header, sizeof(header), "hdr %03d", i);
+        memset(payload, 'a' + i, sizeof(payload));
+        llfs_iovec iov[] = { { header, sizeof(header) }, { payload, sizeof(payload) } };
+
+        e = llfs_fwritev(iov, 2, file);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    char *big = (char *) calloc(BLOCK_SIZE * 16, sizeof(char));
+    if (big == NULL) return llfs_strerror(MEMORY_ALLOC_ERROR);
+    llfs_iovec too_big[] = { { header, sizeof(header) }, { big, BLOCK_SIZE * 16 } };
+    e = llfs_fwritev(too_big, 2, file);
+    free(big);
+    unit_assert(llfs_strerror(e), e == EXCEEDED_MAX_BUFFER_SIZE);
+
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/records.db", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    for (int i = 0; i < num_records; i++) {
+        llfs_iovec iov[] = { { read_header, sizeof(read_header) }, { read_payload, sizeof(read_payload) } };
+        e = llfs_freadv(iov, 2, file);
+        unit_assert(llfs_strerror(e), e == 0);
+
+        snprintf(header, sizeof(header), "hdr %03d", i);
+        memset(payload, 'a' + i, sizeof(payload));
+        unit_assert("Header Did Not Match", memcmp(header, read_header, sizeof(header)) == 0);
+        unit_assert("Payload Did Not Match", memcmp(payload, read_payload, sizeof(payload)) == 0);
+    }
+
+    llfs_iovec iov[] = { { read_header, 1 } };
+    e = llfs_freadv(iov, 1, file);
+    unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_rm("/records.db", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+// Clone a file reaching into the double indirect blocks and modify the copy at every level
+const char *test_clone() {
+    FILE *test_file = fopen("./data_files/classes.xml", "r");
+    if (test_file == NULL) return "Error Opening Test File";
+
+    const int size = BLOCK_SIZE * 140 + 10;
+    // Edits in the direct, single indirect and double indirect blocks of the copy
+    int offsets[] = { 100, BLOCK_SIZE * 40 - 3, BLOCK_SIZE * 139 + 5 };
+    char edit[] = "cloned";
+
+    char *buffer = (char *) calloc(size, sizeof(char));
+    char *expected = (char *) calloc(size, sizeof(char));
+    char *file_data = (char *) calloc(size, sizeof(char));
+    if (buffer == NULL || expected == NULL || file_data == NULL) return llfs_strerror(MEMORY_ALLOC_ERROR);
+
+    size_t read = fread(buffer, sizeof(char), size, test_file);
+    fclose(test_file);
+    unit_assert("Error Reading Bytes From File", read == size);
+
+    llfs_file *file;
+    llfs_error e = llfs_touch("/template.xml");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/template.xml", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fwrite(buffer, sizeof(char), size, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_clone("/template.xml", "/copy.xml");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_clone("/template.xml", "/copy.xml");
+    unit_assert(llfs_strerror(e), e == FILE_ALREADY_EXISTS_ERROR);
+    e = llfs_clone("/missing.xml", "/other.xml");
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    e = llfs_clone("/usr", "/usr_copy");
+    unit_assert(llfs_strerror(e), e == INVALID_OPTION_ERROR);
+
+    e = llfs_fopen("/copy.xml", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    memcpy(expected, buffer, size);
+    for (int i = 0; i < sizeof(offsets) / sizeof(int); i++) {
+        e = llfs_fseek(file, LLFS_FSEEK_SET, offsets[i]);
+        unit_assert(llfs_strerror(e), e == 0);
+        e = llfs_fwrite(edit, sizeof(char), sizeof(edit), file);
+        unit_assert(llfs_strerror(e), e == 0);
+        memcpy(expected + offsets[i], edit, sizeof(edit));
+    }
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // The source keeps its data after the copy is modified
+    e = llfs_fopen("/template.xml", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(file_data, sizeof(char), size, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Source Changed By Write To Clone", memcmp(file_data, buffer, size) == 0);
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // The copy keeps the shared blocks after the source is deleted
+    e = llfs_rm("/template.xml", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/copy.xml", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(file_data, sizeof(char), size, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Clone Data Did Not Match", memcmp(file_data, expected, size) == 0);
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_rm("/copy.xml", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // Small files are copied along with the inode
+    e = llfs_touch("/small.txt");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/small.txt", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fwrite(buffer, sizeof(char), 100, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_clone("/small.txt", "/small_copy.txt");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_rm("/small.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/small_copy.txt", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(file_data, sizeof(char), 100, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Small Clone Data Did Not Match", memcmp(file_data, buffer, 100) == 0);
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_rm("/small_copy.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    free(buffer);
+    free(expected);
+    free(file_data);
+    pass();
+    return 0;
+}
+
+// Read a whole file and compare it with the expected content
+const char *check_content(char *path, char *expected, int len) {
+    char data[64] = { 0 };
+    llfs_file *file;
+    llfs_error e = llfs_fopen(path, &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(data, sizeof(char), len, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(data + len, sizeof(char), 1, file);
+    unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Content Did Not Match", memcmp(data, expected, len) == 0);
+    return 0;
+}
+
+// Write a new file with the content provided
+const char *write_content(char *path, char *content, int len) {
+    llfs_file *file;
+    llfs_error e = llfs_touch(path);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen(path, &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fwrite(content, sizeof(char), len, file);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+    return 0;
+}
+
+const char *test_rename() {
+    llfs_file *file;
+    const char *msg = write_content("/draft.txt", "draft", 5);
+    if (msg != NULL) return msg;
+
+    // Move across directories
+    llfs_error e = llfs_rename("/draft.txt", "/usr/final.txt");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/draft.txt", &file);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    if ((msg = check_content("/usr/final.txt", "draft", 5)) != NULL) return msg;
+
+    // Rename within a directory
+    e = llfs_rename("/usr/final.txt", "/usr/renamed.txt");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/usr/final.txt", &file);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    if ((msg = check_content("/usr/renamed.txt", "draft", 5)) != NULL) return msg;
+
+    e = llfs_rename("/missing.txt", "/other.txt");
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    e = llfs_rename("/usr/renamed.txt", "/lib/renamed.txt");
+    unit_assert(llfs_strerror(e), e == BAD_PATH_ERROR);
+    e = llfs_rename("/usr", "/usr/curtwhite/usr");
+    unit_assert(llfs_strerror(e), e == BAD_PATH_ERROR);
+    e = llfs_rename("/usr/renamed.txt", "/usr/curtwhite");
+    unit_assert(llfs_strerror(e), e == FILE_ALREADY_EXISTS_ERROR);
+
+    // Write a temporary file and rename it over the original
+    if ((msg = write_content("/config.txt", "old", 3)) != NULL) return msg;
+    if ((msg = write_content("/config.tmp", "updated", 7)) != NULL) return msg;
+    e = llfs_rename("/config.tmp", "/config.txt");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/config.tmp", &file);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    if ((msg = check_content("/config.txt", "updated", 7)) != NULL) return msg;
+    e = llfs_rm("/config.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // Directories move along with their children
+    e = llfs_rename("/usr/curtwhite", "/curt");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/curt/file.c", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_fclose(file);
+    e = llfs_rename("/curt", "/usr/curtwhite");
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // Entries after the holes left by moved files can still be found
+    char path[32];
+    e = llfs_mkdir("/many");
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int i = 0; i < 20; i++) {
+        snprintf(path, sizeof(path), "/many/f%d", i);
+        e = llfs_touch(path);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    for (int i = 0; i < 10; i++) {
+        char moved[32];
+        snprintf(path, sizeof(path), "/many/f%d", i);
+        snprintf(moved, sizeof(moved), "/moved%d", i);
+        e = llfs_rename(path, moved);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    for (int i = 10; i < 20; i++) {
+        snprintf(path, sizeof(path), "/many/f%d", i);
+        e = llfs_fopen(path, &file);
+        unit_assert(llfs_strerror(e), e == 0);
+        llfs_fclose(file);
+    }
+    e = llfs_rename("/moved0", "/many/back");
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_rm("/many", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int i = 1; i < 10; i++) {
+        snprintf(path, sizeof(path), "/moved%d", i);
+        e = llfs_rm(path, 0);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    pass();
+    return 0;
+}
+
+const char *test_shared_file() {
+    char data[16] = { 0 };
+    llfs_file *a, *b;
+    llfs_error e = llfs_touch("/shared.txt");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/shared.txt", &a);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/shared.txt", &b);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // Both files see each others writes instead of keeping their own size
+    e = llfs_fwrite("hello", sizeof(char), 5, a);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(data, sizeof(char), 5, b);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Write Not Shared", memcmp(data, "hello", 5) == 0);
+
+    e = llfs_fwrite(" world", sizeof(char), 6, b);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(data, sizeof(char), 6, a);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Write Not Shared", memcmp(data, " world", 6) == 0);
+
+    e = llfs_ftruncate(a, 5);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(data, sizeof(char), 1, b);
+    unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+
+    e = llfs_fclose(a);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fclose(b);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    const char *msg = check_content("/shared.txt", "hello", 5);
+    if (msg != NULL) return msg;
+    e = llfs_rm("/shared.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_readdir() {
+    const int num_files = 40;
+    int seen[40] = { 0 };
+    char path[64];
+    llfs_dir *dir;
+    llfs_dirent entry;
+
+    llfs_error e = llfs_mkdir("/listed");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_mkdir("/listed/sub");
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "/listed/f%02d", i);
+        e = llfs_touch(path);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    const char *msg = write_content("/listed/data", "some data", 9);
+    if (msg != NULL) return msg;
+
+    // Leave holes in the directory blocks which should be skipped
+    for (int i = 0; i < num_files; i += 3) {
+        snprintf(path, sizeof(path), "/listed/f%02d", i);
+        e = llfs_rm(path, 0);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    e = llfs_opendir("/listed", &dir);
+    unit_assert(llfs_strerror(e), e == 0);
+    int count = 0;
+    while ((e = llfs_readdir(dir, &entry)) == 0) {
+        count++;
+        unit_assert("Entry Type Should Be Unknown", entry.type == LLFS_DT_UNKNOWN);
+        if (entry.name[0] == 'f') seen[atoi(entry.name + 1)]++;
+    }
+    unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+    unit_assert("Wrong Number Of Entries", count == num_files - (num_files + 2) / 3 + 2);
+    for (int i = 0; i < num_files; i++) {
+        unit_assert("Entry Listed Wrong Number Of Times", seen[i] == (i % 3 != 0));
+    }
+    e = llfs_closedir(dir);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_opendir("/listed", &dir);
+    unit_assert(llfs_strerror(e), e == 0);
+    while ((e = llfs_readdir_plus(dir, &entry)) == 0) {
+        if (strcmp(entry.name, "sub") == 0) {
+            unit_assert("Wrong Type", entry.type == LLFS_DT_DIR);
+        } else if (strcmp(entry.name, "data") == 0) {
+            unit_assert("Wrong Type", entry.type == LLFS_DT_FLAT);
+            unit_assert("Wrong Size", entry.size == 9);
+        } else {
+            unit_assert("Wrong Type", entry.type == LLFS_DT_FLAT && entry.size == 0);
+        }
+    }
+    unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+    e = llfs_closedir(dir);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_opendir("/listed/sub", &dir);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_readdir(dir, &entry);
+    unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+    e = llfs_closedir(dir);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_opendir("/listed/data", &dir);
+    unit_assert(llfs_strerror(e), e == BAD_PATH_ERROR);
+    e = llfs_opendir("/listed/missing", &dir);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+
+    e = llfs_rm("/listed", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_touch_many() {
+    const int num_files = 60;
+    char names[60][8];
+    char *name_ptrs[60];
+    char path[128];
+    llfs_file *file;
+
+    for (int i = 0; i < num_files; i++) {
+        snprintf(names[i], sizeof(names[i]), "b%02d", i);
+        name_ptrs[i] = names[i];
+    }
+
+    llfs_error e = llfs_mkdir_p("/bulk/a/b");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_mkdir_p("/bulk/a/b/");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_mkdir_p("/bulk/a/c");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_touch_many("/bulk/a/b", name_ptrs, num_files);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "/bulk/a/b/%s", names[i]);
+        e = llfs_fopen(path, &file);
+        unit_assert(llfs_strerror(e), e == 0);
+        llfs_fclose(file);
+    }
+
+    // Everything in front of a name which already exists is still created
+    char *retry[3] = { "new0", "b10", "new1" };
+    e = llfs_touch_many("/bulk/a/c", retry, 2);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_touch_many("/bulk/a/c", retry + 1, 2);
+    unit_assert(llfs_strerror(e), e == FILE_ALREADY_EXISTS_ERROR);
+    e = llfs_touch_many("/bulk/a/b", retry, 3);
+    unit_assert(llfs_strerror(e), e == FILE_ALREADY_EXISTS_ERROR);
+    e = llfs_fopen("/bulk/a/b/new0", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_fclose(file);
+    e = llfs_fopen("/bulk/a/b/new1", &file);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+
+    e = llfs_mkdir_p("/bulk/a/b/b00/d");
+    unit_assert(llfs_strerror(e), e == BAD_PATH_ERROR);
+    e = llfs_touch_many("/bulk/missing", name_ptrs, 1);
+    unit_assert(llfs_strerror(e), e == BAD_PATH_ERROR);
+
+    // Long names convert the directory and split its leaves while a batch is still open
+    const int lengths[3] = { 8, 30, 60 };
+    const int num_long = 120;
+    char (*long_names)[64] = calloc(num_long, sizeof(*long_names));
+    char **long_ptrs = calloc(num_long, sizeof(char *));
+    unit_assert("Allocating Names", long_names != NULL && long_ptrs != NULL);
+    for (int l = 0; l < 3; l++) {
+        for (int i = 0; i < num_long; i++) {
+            snprintf(long_names[i], lengths[l] + 1, "%03d%060d", i, 0);
+            long_ptrs[i] = long_names[i];
+        }
+
+        e = llfs_mkdir_p("/bulk/long");
+        unit_assert(llfs_strerror(e), e == 0);
+        e = llfs_touch_many("/bulk/long", long_ptrs, num_long);
+        unit_assert(llfs_strerror(e), e == 0);
+        for (int i = 0; i < num_long; i++) {
+            snprintf(path, sizeof(path), "/bulk/long/%s", long_names[i]);
+            e = llfs_fopen(path, &file);
+            unit_assert(llfs_strerror(e), e == 0);
+            llfs_fclose(file);
+        }
+
+        e = llfs_rm("/bulk/long", 1);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    free(long_names);
+    free(long_ptrs);
+
+    e = llfs_rm("/bulk", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_openat() {
+    llfs_dir *dir;
+    llfs_file *file;
+    llfs_dirent entry;
+
+    llfs_error e = llfs_mkdir_p("/deep/a/b/c");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_opendir("/deep/a/b/c", &dir);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_touchat(dir, "f1");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_touchat(dir, "f1");
+    unit_assert(llfs_strerror(e), e == FILE_ALREADY_EXISTS_ERROR);
+    e = llfs_mkdirat(dir, "sub");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_touchat(dir, "sub/g");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_touchat(dir, "missing/g");
+    unit_assert(llfs_strerror(e), e == BAD_PATH_ERROR);
+
+    e = llfs_openat(dir, "f1", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_fclose(file);
+    e = llfs_openat(dir, "sub/g", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_fclose(file);
+    e = llfs_openat(dir, "/deep/a/b/c/sub/g", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_fclose(file);
+    e = llfs_openat(dir, "g", &file);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    e = llfs_fopen("/deep/a/b/c/f1", &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_fclose(file);
+
+    e = llfs_rmat(dir, "sub", 0);
+    unit_assert(llfs_strerror(e), e == NON_RECURSIVE_DELETE_ERROR);
+    e = llfs_rmat(dir, "sub", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_rmat(dir, "f1", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_readdir(dir, &entry);
+    unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+    e = llfs_closedir(dir);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_rm("/deep", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
 const char *test_rmdir() {
     llfs_file *file;
     // Not allowed to delete the root dir
@@ -179,6 +850,40 @@ const char *test_rmdir() {
     return 0;
 }
 
+llfs_error count_walk(const char *path, const llfs_inode *inode, void *arg) {
+    if (strcmp(path, "/tree/a/b/g") == 0) return FILE_ALREADY_EXISTS_ERROR;
+    (*(int *) arg)++;
+    return 0;
+}
+
+const char *test_walk() {
+    int count = 0;
+    llfs_error e = llfs_mkdir_p("/tree/a/b");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_touch("/tree/a/f");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_touch("/tree/c");
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_walk("/tree", count_walk, &count, 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Wrong Number Of Entries", count == 4);
+    e = llfs_walk("/tree", count_walk, &count, LLFS_WALK_MAX_THREADS + 1);
+    unit_assert(llfs_strerror(e), e == INVALID_OPTION_ERROR);
+
+    // An error from the callback stops the walk and is returned
+    e = llfs_touch("/tree/a/b/g");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_walk("/tree", count_walk, &count, 1);
+    unit_assert(llfs_strerror(e), e == FILE_ALREADY_EXISTS_ERROR);
+
+    e = llfs_rm("/tree", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
 int main() {
     disk_error err = disk_mount("file_disk");
     if (err != 0) {
@@ -197,6 +902,16 @@ int main() {
         test_touch,
         test_fopen,
         test_fwrite,
+        test_ftruncate,
+        test_fadvise,
+        test_vectored,
+        test_clone,
+        test_rename,
+        test_shared_file,
+        test_readdir,
+        test_touch_many,
+        test_openat,
+        test_walk,
         test_rmdir,
 //         Lets run these again to show everything still preforms after removing
 //         all of the previous files.
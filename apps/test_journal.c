@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "unit_test.h"
 
@@ -20,17 +21,25 @@
 const char *test_recover() {
     const char * test_str = "A string to check if success";
     char write_block[BLOCK_SIZE] = { 0 };
-    journal_descriptor desc = { JOURNAL_DESCRIPTOR, 0, 1, { 33 } };
+    journal_super s;
+    disk_error res = disk_read_block(JOURNAL_LOCATION, (char *) write_block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&s, write_block, sizeof(journal_super));
+
+    memset(write_block, 0, BLOCK_SIZE);
+    journal_descriptor desc = { JOURNAL_DESCRIPTOR, s.log_seq, 1, { 33 } };
     memcpy(write_block, &desc, sizeof(journal_descriptor));
     // Write the descriptor
-    disk_error res = disk_write_block(JOURNAL_LOG_START, (char *) write_block);
+    res = disk_write_block(JOURNAL_LOG_START, (char *) write_block);
     unit_assert(disk_strerror(res), res == 0);
+    uint32_t checksum = journal_crc32c(0, write_block, BLOCK_SIZE);
     memcpy(write_block, test_str, 29);
     // Write some data
     res = disk_write_block(JOURNAL_LOG_START + 1, (char *) write_block);
     unit_assert(disk_strerror(res), res == 0);
+    checksum = journal_crc32c(checksum, write_block, BLOCK_SIZE);
 
-    journal_commit cm = { JOURNAL_COMMIT, 0, 0 };
+    journal_commit cm = { JOURNAL_COMMIT, checksum, 0 };
     memcpy(write_block, &cm, sizeof(journal_commit));
     // Commit the transaction
     res = disk_write_block(JOURNAL_LOG_START + 2, (char *) write_block);
@@ -43,7 +52,6 @@ const char *test_recover() {
     unit_assert(disk_strerror(res), res == 0);
     unit_assert("Did not match", strcmp(write_block, test_str) == 0);
     // Make sure the log was advanced to the right location
-    journal_super s;
     res = disk_read_block(JOURNAL_LOCATION, (char *) write_block);
     unit_assert(disk_strerror(res), res == 0);
     memcpy(&s, write_block, sizeof(journal_super));
@@ -84,6 +92,324 @@ const char *test_empty_reset() {
     return 0;
 }
 
+const char *test_checksum() {
+    // The standard check value of crc32c
+    unit_assert("Wrong Checksum", journal_crc32c(0, "123456789", 9) == 0xE3069283);
+    unit_assert("Checksum Not Chained", journal_crc32c(journal_crc32c(0, "1234", 4), "56789", 5) == 0xE3069283);
+
+    char block[BLOCK_SIZE];
+    for (int i = 0; i < BLOCK_SIZE; i++) block[i] = (char) (i * 7);
+    uint32_t whole = journal_crc32c(0, block, BLOCK_SIZE);
+    uint32_t unaligned = journal_crc32c(journal_crc32c(0, block, 3), block + 3, BLOCK_SIZE - 3);
+    unit_assert("Unaligned Checksum Differs", whole == unaligned);
+
+    pass();
+    return 0;
+}
+
+/* A transaction whose data does not match its checksum was torn by a crash and must not
+ * be replayed
+*/
+const char *test_torn_transaction() {
+    char block[BLOCK_SIZE] = { 0 };
+    char home[BLOCK_SIZE] = { 0 };
+    disk_error res = disk_read_block(34, home);
+    unit_assert(disk_strerror(res), res == 0);
+
+    journal_super s;
+    res = disk_read_block(JOURNAL_LOCATION, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&s, block, sizeof(journal_super));
+
+    journal_descriptor desc = { JOURNAL_DESCRIPTOR, s.log_seq, 1, { 34 } };
+    memset(block, 0, BLOCK_SIZE);
+    memcpy(block, &desc, sizeof(journal_descriptor));
+    res = disk_write_block(JOURNAL_LOG_START + s.log_start, block);
+    unit_assert(disk_strerror(res), res == 0);
+    uint32_t checksum = journal_crc32c(0, block, BLOCK_SIZE);
+
+    memset(block, 'x', BLOCK_SIZE);
+    checksum = journal_crc32c(checksum, block, BLOCK_SIZE);
+    // Only part of the data made it to the journal before the crash
+    memset(block + BLOCK_SIZE / 2, 0, BLOCK_SIZE / 2);
+    res = disk_write_block(JOURNAL_LOG_START + s.log_start + 1, block);
+    unit_assert(disk_strerror(res), res == 0);
+
+    journal_commit cm = { JOURNAL_COMMIT, checksum, 0 };
+    memset(block, 0, BLOCK_SIZE);
+    memcpy(block, &cm, sizeof(journal_commit));
+    res = disk_write_block(JOURNAL_LOG_START + s.log_start + 2, block);
+    unit_assert(disk_strerror(res), res == 0);
+
+    llfs_error err = journal_recover();
+    unit_assert(llfs_strerror(err), err == 0);
+    res = disk_read_block(34, block);
+    unit_assert(disk_strerror(res), res == 0);
+    unit_assert("Torn Transaction Replayed", memcmp(block, home, BLOCK_SIZE) == 0);
+
+    pass();
+    return 0;
+}
+
+/* A complete transaction left from an earlier pass around the log has an older sequence number
+ * and must not be replayed
+*/
+const char *test_stale_transaction() {
+    char block[BLOCK_SIZE] = { 0 };
+    char home[BLOCK_SIZE] = { 0 };
+    disk_error res = disk_read_block(35, home);
+    unit_assert(disk_strerror(res), res == 0);
+
+    journal_super s;
+    res = disk_read_block(JOURNAL_LOCATION, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&s, block, sizeof(journal_super));
+
+    journal_descriptor desc = { JOURNAL_DESCRIPTOR, s.log_seq - 1, 1, { 35 } };
+    memset(block, 0, BLOCK_SIZE);
+    memcpy(block, &desc, sizeof(journal_descriptor));
+    res = disk_write_block(JOURNAL_LOG_START + s.log_start, block);
+    unit_assert(disk_strerror(res), res == 0);
+    uint32_t checksum = journal_crc32c(0, block, BLOCK_SIZE);
+
+    memset(block, 's', BLOCK_SIZE);
+    res = disk_write_block(JOURNAL_LOG_START + s.log_start + 1, block);
+    unit_assert(disk_strerror(res), res == 0);
+    checksum = journal_crc32c(checksum, block, BLOCK_SIZE);
+
+    journal_commit cm = { JOURNAL_COMMIT, checksum, 0 };
+    memset(block, 0, BLOCK_SIZE);
+    memcpy(block, &cm, sizeof(journal_commit));
+    res = disk_write_block(JOURNAL_LOG_START + s.log_start + 2, block);
+    unit_assert(disk_strerror(res), res == 0);
+
+    llfs_error err = journal_recover();
+    unit_assert(llfs_strerror(err), err == 0);
+    res = disk_read_block(35, block);
+    unit_assert(disk_strerror(res), res == 0);
+    unit_assert("Stale Transaction Replayed", memcmp(block, home, BLOCK_SIZE) == 0);
+
+    pass();
+    return 0;
+}
+
+/* A block committed again with a few bytes changed is logged as delta records, which replay onto
+ * whatever is at home, even a copy which was already checkpointed
+*/
+const char *test_delta_records() {
+    const int count = 8;
+    char data[8][BLOCK_SIZE], block[BLOCK_SIZE];
+    file_block blocks[8];
+    journal_super s;
+
+    journal_set_commit_interval(0);
+    llfs_error err = journal_checkpoint();
+    unit_assert(llfs_strerror(err), err == 0);
+    disk_error res = disk_read_block(JOURNAL_LOCATION, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&s, block, sizeof(journal_super));
+    const uint32_t start = s.log_start;
+
+    for (int i = 0; i < count; i++) {
+        memset(data[i], 'a' + i, BLOCK_SIZE);
+        blocks[i] = (file_block) { 40 + i, data[i], FB_REF };
+    }
+    err = journal_new_transaction(blocks, count);
+    unit_assert(llfs_strerror(err), err == 0);
+    for (int i = 0; i < count; i++) data[i][i * 9] = 'z';
+    err = journal_new_transaction(blocks, count);
+    unit_assert(llfs_strerror(err), err == 0);
+
+    // As if the crash came part way through checkpointing the newest copies
+    res = disk_write_block(40, data[0]);
+    unit_assert(disk_strerror(res), res == 0);
+    err = journal_recover();
+    unit_assert(llfs_strerror(err), err == 0);
+
+    for (int i = 0; i < count; i++) {
+        res = disk_read_block(40 + i, block);
+        unit_assert(disk_strerror(res), res == 0);
+        unit_assert("Delta Not Replayed", memcmp(block, data[i], BLOCK_SIZE) == 0);
+    }
+
+    // The whole blocks take a descriptor, the blocks and a commit block, the changes to all of
+    // them fit in one delta block
+    res = disk_read_block(JOURNAL_LOCATION, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&s, block, sizeof(journal_super));
+    unit_assert("Delta Not Compact", s.log_start == (start + count + 2 + 3) % (JOURNAL_LENGTH - 1));
+    journal_set_commit_interval(JOURNAL_COMMIT_INTERVAL);
+
+    pass();
+    return 0;
+}
+
+/* A journal formatted longer than the default commits a large write as one transaction which
+ * needs more than one descriptor block
+*/
+const char *test_long_transaction() {
+    const int size = 70000;
+    llfs_error err = InitLLFSJournal(JOURNAL_LENGTH - 1);
+    unit_assert(llfs_strerror(err), err == INVALID_OPTION_ERROR);
+    err = InitLLFSJournal(300);
+    unit_assert(llfs_strerror(err), err == 0);
+    err = llfs_touch("/big");
+    unit_assert(llfs_strerror(err), err == 0);
+    err = llfs_fsync();
+    unit_assert(llfs_strerror(err), err == 0);
+
+    journal_super s;
+    char block[BLOCK_SIZE];
+    disk_error res = disk_read_block(JOURNAL_LOCATION, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&s, block, sizeof(journal_super));
+    unit_assert("Wrong Journal Length", s.block_count == 300);
+
+    char *data = (char *) malloc(size);
+    char *read = (char *) calloc(size, sizeof(char));
+    if (data == NULL || read == NULL) return llfs_strerror(MEMORY_ALLOC_ERROR);
+    for (int i = 0; i < size; i++) data[i] = (char) ('a' + i % 26);
+
+    llfs_file *file;
+    err = llfs_fopen("/big", &file);
+    unit_assert(llfs_strerror(err), err == 0);
+    err = llfs_fwrite(data, sizeof(char), size, file);
+    unit_assert(llfs_strerror(err), err == 0);
+    err = journal_flush();
+    unit_assert(llfs_strerror(err), err == 0);
+
+    journal_descriptor first, second;
+    res = disk_read_block(JOURNAL_LOG_START + s.log_start, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&first, block, sizeof(journal_descriptor));
+    unit_assert("First Descriptor Not Full", first.block_type == JOURNAL_DESCRIPTOR && first.num_blocks == JOURNAL_DESCRIPTOR_TAGS);
+    res = disk_read_block(JOURNAL_LOG_START + s.log_start + JOURNAL_DESCRIPTOR_TAGS + 1, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&second, block, sizeof(journal_descriptor));
+    unit_assert("Descriptor Not Chained", second.block_type == JOURNAL_DESCRIPTOR && second.num_blocks > 0);
+    res = disk_read_block(JOURNAL_LOG_START + s.log_start + JOURNAL_DESCRIPTOR_TAGS + second.num_blocks + 2, block);
+    unit_assert(disk_strerror(res), res == 0);
+    unit_assert("Not One Transaction", *(uint32_t *) block == JOURNAL_COMMIT);
+
+    // Replay it as if the system crashed before the blocks were checkpointed
+    err = journal_recover();
+    unit_assert(llfs_strerror(err), err == 0);
+    err = llfs_fseek(file, LLFS_FSEEK_START, 0);
+    unit_assert(llfs_strerror(err), err == 0);
+    err = llfs_fread(read, sizeof(char), size, file);
+    unit_assert(llfs_strerror(err), err == 0);
+    unit_assert("Data Not Replayed", memcmp(read, data, size) == 0);
+
+    free(data);
+    free(read);
+    llfs_fclose(file);
+    err = InitLLFS();
+    unit_assert(llfs_strerror(err), err == 0);
+
+    pass();
+    return 0;
+}
+
+/* Fill the longest journal with committed transactions and time replaying all of them
+*/
+const char *test_recover_full() {
+    const int home_start = 1100, homes = 900, per = 10;
+    char data[10][BLOCK_SIZE], block[BLOCK_SIZE];
+    char expected[900];
+    file_block blocks[10];
+    memset(expected, 0, sizeof(expected));
+
+    llfs_error err = InitLLFSJournal(JOURNAL_MAX_LENGTH);
+    unit_assert(llfs_strerror(err), err == 0);
+    journal_set_commit_interval(0);
+
+    // Leave the last transaction's worth of the log free so nothing is checkpointed
+    const int count = (JOURNAL_MAX_LENGTH - 1) / (per + 2) - 1;
+    for (int t = 0; t < count; t++) {
+        for (int j = 0; j < per; j++) {
+            const int home = (t * 37 + j * 101) % homes;
+            const char fill = (char) ('A' + (t + j) % 58);
+            memset(data[j], fill, BLOCK_SIZE);
+            blocks[j] = (file_block) { home_start + home, data[j], FB_REF };
+            expected[home] = fill;
+        }
+
+        err = journal_new_transaction(blocks, per);
+        unit_assert(llfs_strerror(err), err == 0);
+    }
+
+    journal_super s;
+    disk_error res = disk_read_block(JOURNAL_LOCATION, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&s, block, sizeof(journal_super));
+    unit_assert("Checkpointed Early", s.log_start == 0);
+
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    err = journal_recover();
+    timespec_get(&end, TIME_UTC);
+    unit_assert(llfs_strerror(err), err == 0);
+    const double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    printf("Recovered %d transactions of %d blocks in %.2fms\n", count, per, ms);
+
+    for (int i = 0; i < homes; i++) {
+        if (expected[i] == 0) continue;
+        res = disk_read_block(home_start + i, block);
+        unit_assert(disk_strerror(res), res == 0);
+        unit_assert("Wrong Copy Replayed", block[0] == expected[i] && block[BLOCK_SIZE - 1] == expected[i]);
+    }
+
+    res = disk_read_block(JOURNAL_LOCATION, block);
+    unit_assert(disk_strerror(res), res == 0);
+    memcpy(&s, block, sizeof(journal_super));
+    unit_assert("Log Not Advanced", s.log_start == (uint32_t) count * (per + 2));
+
+    journal_set_commit_interval(JOURNAL_COMMIT_INTERVAL);
+    err = InitLLFS();
+    unit_assert(llfs_strerror(err), err == 0);
+
+    pass();
+    return 0;
+}
+
+/**
+ * Time the checksum of a longest transaction, its descriptor and blocks, with the crc32
+ * instruction and with the slicing by 8 tables
+ */
+const char *test_checksum_cost() {
+    const int per = journal_max_transaction() + 1, rounds = 2000;
+    char *data = (char *) malloc(per * BLOCK_SIZE);
+    unit_assert("Allocating Data", data != NULL);
+    for (int i = 0; i < per * BLOCK_SIZE; i++) data[i] = (char) (i * 31 + i / BLOCK_SIZE);
+
+    double us[2] = { 0, 0 };
+    uint32_t sums[2] = { 0, 0 };
+    int hw = 0;
+    for (int path = 0; path < 2; path++) {
+        const int used = journal_crc32c_select(path == 0);
+        if (path == 0) hw = used;
+
+        struct timespec start, end;
+        timespec_get(&start, TIME_UTC);
+        for (int r = 0; r < rounds; r++) {
+            uint32_t checksum = 0;
+            for (int b = 0; b < per; b++) checksum = journal_crc32c(checksum, data + b * BLOCK_SIZE, BLOCK_SIZE);
+            sums[path] ^= checksum + r;
+        }
+        timespec_get(&end, TIME_UTC);
+        us[path] = ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0) / rounds;
+    }
+
+    journal_crc32c_select(1);
+    free(data);
+    unit_assert("Checksums Differ", sums[0] == sums[1]);
+    if (hw) printf("Checksummed a %d block transaction in %.2fus with SSE4.2, %.2fus with slicing by 8\n", per - 1, us[0], us[1]);
+    else printf("Checksummed a %d block transaction in %.2fus with slicing by 8, SSE4.2 unavailable\n", per - 1, us[1]);
+
+    pass();
+    return 0;
+}
+
 int main() {
     disk_mount("journal_disk");
 
@@ -94,7 +420,14 @@ int main() {
     unit tests[] = {
         test_recover,
         test_blank,
-        test_empty_reset
+        test_empty_reset,
+        test_checksum,
+        test_checksum_cost,
+        test_torn_transaction,
+        test_stale_transaction,
+        test_delta_records,
+        test_long_transaction,
+        test_recover_full
     };
 
     const char *msg = run_tests(tests, sizeof(tests) / sizeof(unit));
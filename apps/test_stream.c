@@ -0,0 +1,151 @@
+//
+// Created by curt white on 2020-04-06.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../io/File.h"
+#include "../io/stream.h"
+#include "../disk/disk.h"
+#include "unit_test.h"
+
+// Read the whole file back and compare it to the expected contents
+const char *check_file(char *path, const char *expected, int size) {
+    llfs_file *file;
+    llfs_error e = llfs_fopen(path, &file);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    char *data = (char *) calloc(size + 1, sizeof(char));
+    if (data == NULL) return llfs_strerror(MEMORY_ALLOC_ERROR);
+
+    e = llfs_fread(data, sizeof(char), size, file);
+    int match = memcmp(data, expected, size) == 0;
+    llfs_error eof = llfs_fread(data + size, sizeof(char), 1, file);
+
+    free(data);
+    llfs_fclose(file);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("File Data Did Not Match", match);
+    unit_assert("File Is Larger Than Expected", eof == END_OF_FILE_ERROR);
+    return 0;
+}
+
+const char *test_stream_open() {
+    llfs_stream *s;
+    llfs_error e = llfs_stream_open("/missing.log", 0, 0, &s);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    unit_assert("Stream Not NULL", s == NULL);
+
+    e = llfs_stream_open("/app.log", -1, 0, &s);
+    unit_assert(llfs_strerror(e), e == INVALID_OPTION_ERROR);
+
+    pass();
+    return 0;
+}
+
+// Small records are held in memory until whole blocks can be written
+const char *test_stream_threshold() {
+    const int record_size = 100, num_records = 100;
+    char *expected = (char *) calloc(record_size * num_records, sizeof(char));
+    if (expected == NULL) return llfs_strerror(MEMORY_ALLOC_ERROR);
+
+    llfs_stream *s;
+    llfs_error e = llfs_stream_open("/app.log", BLOCK_SIZE * 2, 0, &s);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    for (int i = 0; i < num_records; i++) {
+        char *record = expected + i * record_size;
+        snprintf(record, record_size, "record %d", i);
+        memset(record + strlen(record), '.', record_size - strlen(record) - 1);
+        record[record_size - 1] = '\n';
+
+        e = llfs_stream_write(s, record, record_size);
+        unit_assert(llfs_strerror(e), e == 0);
+
+        // Nothing is written until the threshold is reached
+        if (i == 0) {
+            const char *msg = check_file("/app.log", expected, 0);
+            if (msg != NULL) return msg;
+        }
+    }
+
+    // Only whole blocks have been written so far, two at a time
+    const char *msg = check_file("/app.log", expected, 18 * BLOCK_SIZE);
+    if (msg != NULL) return msg;
+
+    e = llfs_stream_flush(s);
+    unit_assert(llfs_strerror(e), e == 0);
+    msg = check_file("/app.log", expected, record_size * num_records);
+    if (msg != NULL) return msg;
+
+    e = llfs_stream_close(s);
+    free(expected);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+// A quiet stream is written once the interval has passed
+const char *test_stream_interval() {
+    llfs_stream *s;
+    llfs_error e = llfs_stream_open("/timer.log", 0, 5, &s);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_stream_write(s, "tick\n", 5);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_stream_poll(s);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    struct timespec start, now;
+    timespec_get(&start, TIME_UTC);
+    do {
+        timespec_get(&now, TIME_UTC);
+    } while ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 < 10);
+
+    e = llfs_stream_poll(s);
+    unit_assert(llfs_strerror(e), e == 0);
+    const char *msg = check_file("/timer.log", "tick\n", 5);
+    if (msg != NULL) return msg;
+
+    // Closing writes whatever is left
+    e = llfs_stream_write(s, "tock\n", 5);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_stream_close(s);
+    unit_assert(llfs_strerror(e), e == 0);
+    msg = check_file("/timer.log", "tick\ntock\n", 10);
+    if (msg != NULL) return msg;
+
+    pass();
+    return 0;
+}
+
+int main() {
+    disk_mount("stream_disk");
+
+    llfs_error e = InitLLFS();
+    if (e != 0) printf("%s\n", llfs_strerror(e));
+
+    e = llfs_touch("/app.log");
+    if (e != 0) printf("%s\n", llfs_strerror(e));
+    e = llfs_touch("/timer.log");
+    if (e != 0) printf("%s\n", llfs_strerror(e));
+
+    test_header();
+    unit tests[] = {
+        test_stream_open,
+        test_stream_threshold,
+        test_stream_interval
+    };
+
+    const char *msg = run_tests(tests, sizeof(tests) / sizeof(unit));
+    if (msg != NULL) {
+        fail_msg(msg);
+    } else {
+        pass_all();
+    }
+
+    return 0;
+}
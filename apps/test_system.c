@@ -1,3 +1,4 @@
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,7 +42,7 @@ const char *test_reserve_blocks() {
 }
 
 const char *test_write_buffer() {
-    llfs_write_buffer w;
+    llfs_write_buffer w = { NULL, 0 };
 
     for (int i = 0; i < 20; i++) {
         file_block f = { i, NULL };
@@ -264,7 +265,8 @@ const char *test_dir_append() {
 
     char buffer[BLOCK_SIZE] = { 0 };
     e = llfs_get_bytes(&f, buffer, BLOCK_SIZE, 0);
-    unit_assert("Bad Write", strcmp(((dir_entry *) buffer)[0].name, "something.txt") == 0);
+    dir_record *r = (dir_record *) buffer;
+    unit_assert("Bad Write", r->inode == 8 && r->name_len == 13 && memcmp(r + 1, "something.txt", 13) == 0);
     unit_assert(llfs_strerror(e), e == 0 || e == END_OF_FILE_ERROR);
 
     llfs_destroy_file(&f);
@@ -273,6 +275,118 @@ const char *test_dir_append() {
     return 0;
 }
 
+const char *test_inline_file() {
+    const char *content = "key = value";
+    const int len = strlen(content) + 1;
+
+    llfs_error e = llfs_create_file("/inline.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    llfs_file file;
+    llfs_inode i;
+    int loc;
+    e = llfs_get_inode("/inline.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_open_file(&i, &file, loc);
+    unit_assert(llfs_strerror(e), e == 0 || e == EMPTY_FILE_ERROR);
+
+    e = llfs_write((char *) content, sizeof(char), len, &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_destroy_file(&file);
+
+    // Small files do not get a data block
+    e = llfs_get_inode("/inline.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Data Not Inline", i.flags.inline_data == 1 && i.direct[0] == 0);
+    unit_assert("Wrong Size", i.file_size == len);
+
+    char data[BLOCK_SIZE * 2] = { 0 };
+    e = llfs_open_file(&i, &file, loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_bytes(&file, data, len, 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Inline Data Did Not Match", strcmp(data, content) == 0);
+
+    // Grow past the inline space so the data moves into regular blocks
+    char more[BLOCK_SIZE];
+    for (int j = 0; j < BLOCK_SIZE; j++) more[j] = (char) ('a' + j % 26);
+    e = llfs_write(more, sizeof(char), BLOCK_SIZE, &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_destroy_file(&file);
+
+    e = llfs_get_inode("/inline.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Data Still Inline", i.flags.inline_data == 0 && i.direct[0] != 0 && i.direct[1] != 0);
+
+    e = llfs_open_file(&i, &file, loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_bytes(&file, data, len + BLOCK_SIZE, 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Migrated Data Did Not Match", strcmp(data, content) == 0);
+    unit_assert("Migrated Data Did Not Match", memcmp(data + len, more, BLOCK_SIZE) == 0);
+    llfs_destroy_file(&file);
+
+    e = llfs_delete("/inline.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_readahead() {
+    char data[BLOCK_SIZE * 40];
+    for (int j = 0; j < sizeof(data); j++) data[j] = (char) (j / BLOCK_SIZE);
+
+    llfs_error e = llfs_create_file("/readahead.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    llfs_file file;
+    llfs_inode i;
+    int loc;
+    e = llfs_get_inode("/readahead.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_open_file(&i, &file, loc);
+    unit_assert(llfs_strerror(e), e == 0 || e == EMPTY_FILE_ERROR);
+    e = llfs_fwrite(data, sizeof(char), sizeof(data), &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_destroy_file(&file);
+
+    // Opening only reads the first window
+    e = llfs_get_inode("/readahead.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_open_file(&i, &file, loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("First Window Not Read", file.direct[3].block_data != NULL);
+    unit_assert("Read Past First Window", file.direct[4].block_data == NULL);
+
+    // Continuing the stream doubles the window
+    char read[BLOCK_SIZE * 5];
+    e = llfs_get_bytes(&file, read, sizeof(read), 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Data Did Not Match", memcmp(read, data, sizeof(read)) == 0);
+    unit_assert("Second Window Not Read", file.ind.blocks[1].block_data != NULL);
+    unit_assert("Read Past Second Window", file.ind.blocks[2].block_data == NULL);
+
+    // Random access only reads the block it needs
+    e = llfs_advise(&file, 0, 0, LLFS_ADV_RANDOM);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_seek(&file, LLFS_SEEK_SET, BLOCK_SIZE * 30);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_bytes(&file, read, BLOCK_SIZE, 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Data Did Not Match", memcmp(read, data + BLOCK_SIZE * 30, BLOCK_SIZE) == 0);
+    unit_assert("Random Block Not Read", file.ind.blocks[20].block_data != NULL);
+    unit_assert("Read Ahead While Random", file.ind.blocks[21].block_data == NULL);
+
+    llfs_destroy_file(&file);
+    e = llfs_delete("/readahead.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
 const char *test_delete_file() {
     llfs_error e = llfs_delete("/contents.txt", 0);
     unit_assert(llfs_strerror(e), e == 0);
@@ -289,6 +403,1150 @@ const char *test_delete_file() {
     return 0;
 }
 
+const char *test_clone_file() {
+    char data[BLOCK_SIZE * 3];
+    for (int j = 0; j < sizeof(data); j++) data[j] = (char) ('a' + j % 26);
+
+    llfs_error e = llfs_create_file("/origin.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    llfs_file file;
+    llfs_inode i, c;
+    int loc, clone_loc;
+    e = llfs_get_inode("/origin.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_open_file(&i, &file, loc);
+    unit_assert(llfs_strerror(e), e == 0 || e == EMPTY_FILE_ERROR);
+    e = llfs_write(data, sizeof(char), sizeof(data), &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_destroy_file(&file);
+
+    e = llfs_clone_file("/origin.txt", "/clone.txt");
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // The clone points at the same data blocks from its own inode
+    e = llfs_get_inode("/origin.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/clone.txt", &c, &clone_loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Clone Shares The Inode", loc != clone_loc);
+    unit_assert("Clone Size Differs", c.file_size == i.file_size);
+    unit_assert("Clone Does Not Share Data", memcmp(c.direct, i.direct, sizeof(i.direct)) == 0);
+
+    // Only the modified block gets a copy
+    e = llfs_open_file(&c, &file, clone_loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_seek(&file, LLFS_SEEK_SET, BLOCK_SIZE + 10);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_write("copy", sizeof(char), 4, &file);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_destroy_file(&file);
+
+    e = llfs_get_inode("/clone.txt", &c, &clone_loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Unmodified Block Copied", c.direct[0] == i.direct[0] && c.direct[2] == i.direct[2]);
+    unit_assert("Modified Block Still Shared", c.direct[1] != i.direct[1] && c.direct[1] != 0);
+
+    char read[sizeof(data)];
+    e = llfs_open_file(&i, &file, loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_bytes(&file, read, sizeof(read), 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Source Data Changed", memcmp(read, data, sizeof(data)) == 0);
+    llfs_destroy_file(&file);
+
+    e = llfs_delete("/origin.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_delete("/clone.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+// Count the bits set in a block, which are the free blocks of the free block map
+int count_bits(const unsigned char *block) {
+    int bits = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        for (unsigned int b = block[i]; b != 0; b >>= 1u) bits += (int) (b & 1u);
+    }
+    return bits;
+}
+
+const char *test_clone_rollback() {
+    const int size = BLOCK_SIZE * 1200;
+    unsigned char free_map[BLOCK_SIZE], refs[BLOCK_SIZE * 8], block[BLOCK_SIZE];
+    llfs_file *f;
+    llfs_inode i;
+    int loc;
+
+    // A file this large needs more indirect block copies than the default journal can commit at once
+    char *data = (char *) calloc(size, sizeof(char));
+    unit_assert("Allocating Data", data != NULL);
+    llfs_error e = llfs_touch("/huge");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/huge", &f);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fwrite(data, sizeof(char), size, f);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fclose(f);
+    unit_assert(llfs_strerror(e), e == 0);
+    free(data);
+    e = llfs_touch("/marker");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = journal_read_block(FREE_BLOCK_LOC, (char *) free_map);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int j = 0; j < 8; j++) {
+        e = journal_read_block(REF_COUNT_LOC + j, (char *) refs + j * BLOCK_SIZE);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    e = llfs_clone_file("/huge", "/huge_copy");
+    unit_assert(llfs_strerror(e), e == TRANSACTION_TOO_LARGE_ERROR);
+    e = llfs_get_inode("/huge_copy", &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+
+    // The next commit writes the maps, which must not keep anything the failed clone took
+    e = llfs_delete("/marker", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_read_block(FREE_BLOCK_LOC, (char *) block);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Clone Blocks Leaked", count_bits(block) == count_bits(free_map) + 1);
+    for (int j = 0; j < 8; j++) {
+        e = journal_read_block(REF_COUNT_LOC + j, (char *) block);
+        unit_assert(llfs_strerror(e), e == 0);
+        unit_assert("Clone References Leaked", memcmp(block, refs + j * BLOCK_SIZE, BLOCK_SIZE) == 0);
+    }
+
+    e = llfs_delete("/huge", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+// Count the blocks of a file which have been read into memory
+int loaded_blocks(llfs_file *f) {
+    int loaded = 0;
+    for (int i = 0; i < 10; i++) loaded += f->direct[i].block_data != NULL;
+    if (f->ind.blocks != NULL) {
+        for (int i = 0; i < BLOCK_SIZE / 4; i++) loaded += f->ind.blocks[i].block_data != NULL;
+    }
+
+    return loaded;
+}
+
+const char *test_create_many_rollback() {
+    const int num_names = 300;
+    unsigned char free_map[BLOCK_SIZE], block[BLOCK_SIZE];
+    char names[300][16], path[32];
+    char *name_ptrs[300];
+    llfs_inode i;
+    int loc, created = 0;
+
+    for (int j = 0; j < num_names; j++) {
+        snprintf(names[j], sizeof(names[j]), "crowded%03d", j);
+        name_ptrs[j] = names[j];
+    }
+
+    llfs_error e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_read_block(FREE_BLOCK_LOC, (char *) free_map);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // There are fewer inodes than names so the batch fails part way through a transaction
+    e = llfs_create_dirs("/crowd");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_create_many("/crowd", name_ptrs, num_names, FLAT, &created);
+    unit_assert(llfs_strerror(e), e == DISK_FULL_ERROR);
+    unit_assert("Wrong Number Created", created > 0 && created < num_names);
+
+    snprintf(path, sizeof(path), "/crowd/%s", names[created - 1]);
+    e = llfs_get_inode(path, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    snprintf(path, sizeof(path), "/crowd/%s", names[created]);
+    e = llfs_get_inode(path, &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+
+    // Only the files which were committed hold blocks once the failed batch is gone
+    e = llfs_delete("/crowd", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_read_block(FREE_BLOCK_LOC, (char *) block);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Batch Blocks Leaked", count_bits(block) == count_bits(free_map));
+
+    pass();
+    return 0;
+}
+
+const char *test_hashed_dir() {
+    const int num_files = 100;
+    char path[64];
+
+    llfs_error e = llfs_create_file("/hashed", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "/hashed/file%03d.txt", i);
+        e = llfs_create_file(path, FLAT);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    llfs_inode i;
+    int loc;
+    e = llfs_get_inode("/hashed", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Directory Not Indexed", i.flags.dir_index == 1);
+    unit_assert("Wrong Directory Size", i.file_size == num_files * DIR_REC_LEN(11));
+
+    // A lookup only reads the index and one leaf
+    llfs_file dir;
+    e = llfs_open_file(&i, &dir, loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    int inode_block;
+    e = llfs_search_dir(&dir, "file077.txt", &inode_block);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Lookup Read Too Many Blocks", loaded_blocks(&dir) == 2);
+    e = llfs_search_dir(&dir, "missing.txt", &inode_block);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    llfs_destroy_file(&dir);
+
+    e = llfs_create_file("/hashed/file042.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == FILE_ALREADY_EXISTS_ERROR);
+
+    for (int j = 0; j < num_files; j += 2) {
+        snprintf(path, sizeof(path), "/hashed/file%03d.txt", j);
+        e = llfs_delete(path, 0);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    llfs_inode f;
+    for (int j = 0; j < num_files; j++) {
+        snprintf(path, sizeof(path), "/hashed/file%03d.txt", j);
+        e = llfs_get_inode(path, &f, &loc);
+        unit_assert(llfs_strerror(e), e == (j % 2 == 0 ? FILE_NOT_FOUND_ERROR : 0));
+    }
+
+    e = llfs_create_file("/hashed/file000.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/hashed/file000.txt", &f, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/hashed", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Wrong Directory Size", i.file_size == (num_files / 2 + 1) * DIR_REC_LEN(11));
+
+    e = llfs_delete("/hashed", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/hashed/file001.txt", &f, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+
+    pass();
+    return 0;
+}
+
+const char *test_long_names() {
+    const int num_files = 48;
+    char path[LLFS_NAME_MAX + 16];
+
+    // Every leaf only holds one of these names so a full leaf can never be split
+    llfs_error e = llfs_create_file("/long", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "/long/%03d", i);
+        memset(path + 9, 'n', LLFS_NAME_MAX - 3);
+        path[6 + LLFS_NAME_MAX] = '\0';
+        e = llfs_create_file(path, FLAT);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    llfs_inode i;
+    int loc;
+    e = llfs_get_inode("/long", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Directory Not Indexed", i.flags.dir_index == 1);
+    unit_assert("Wrong Directory Size", i.file_size == num_files * DIR_REC_LEN(LLFS_NAME_MAX));
+
+    for (int j = 0; j < num_files; j++) {
+        snprintf(path, sizeof(path), "/long/%03d", j);
+        memset(path + 9, 'n', LLFS_NAME_MAX - 3);
+        path[6 + LLFS_NAME_MAX] = '\0';
+        e = llfs_get_inode(path, &i, &loc);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    e = llfs_delete("/long", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    pass();
+    return 0;
+}
+
+const char *test_dentry_cache() {
+    llfs_inode i;
+    int root_loc, dir_loc, sub_loc, loc;
+    llfs_error e = llfs_create_file("/cached", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_create_file("/cached/sub", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_create_file("/cached/sub/leaf.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_get_inode("/", &i, &root_loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/cached", &i, &dir_loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/cached/sub", &i, &sub_loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/cached/sub/leaf.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    dentry *d = llfs_dcache_find(root_loc, "cached");
+    unit_assert("Directory Not Cached", d != NULL && d->inode_loc == dir_loc);
+    d = llfs_dcache_find(sub_loc, "leaf.txt");
+    unit_assert("File Not Cached", d != NULL && d->inode_loc == loc);
+
+    // Missing names are cached until they are created
+    e = llfs_get_inode("/cached/later.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    d = llfs_dcache_find(dir_loc, "later.txt");
+    unit_assert("Missing Name Not Cached", d != NULL && d->inode_loc == 0);
+
+    e = llfs_create_file("/cached/later.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/cached/later.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_rename_file("/cached/later.txt", "/cached/moved.txt");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/cached/later.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    e = llfs_get_inode("/cached/moved.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // Names inside a deleted directory are dropped so a new directory does not see them
+    e = llfs_delete("/cached/sub", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Deleted Child Still Cached", llfs_dcache_find(sub_loc, "leaf.txt") == NULL);
+    d = llfs_dcache_find(dir_loc, "sub");
+    unit_assert("Deleted Directory Not Negative", d != NULL && d->inode_loc == 0);
+
+    e = llfs_create_file("/cached/sub", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/cached/sub/leaf.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+
+    e = llfs_delete("/cached", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/cached/moved.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+
+    pass();
+    return 0;
+}
+
+const char *test_uncommitted_names() {
+    llfs_inode i;
+    llfs_file f;
+    int dir_loc, loc;
+    llfs_error e = llfs_create_file("/pending", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_create_file("/pending/a.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/pending/ghost", &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    e = llfs_get_inode("/pending", &i, &dir_loc);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // A name appended to a buffer which never commits must not reach the cache
+    e = llfs_open_file(&i, &f, dir_loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_write_buffer w = { NULL, 0 };
+    dir_entry d = { 1, "ghost" };
+    e = llfs_dir_append(&w, &f, d);
+    unit_assert(llfs_strerror(e), e == 0);
+    dentry *c = llfs_dcache_find(dir_loc, "ghost");
+    unit_assert("Uncommitted Name Cached", c == NULL || c->inode_loc == 0);
+    write_buffer_destroy(&w);
+    llfs_destroy_file(&f);
+
+    e = llfs_get_inode("/pending/ghost", &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+
+    e = llfs_delete("/pending", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    pass();
+    return 0;
+}
+
+const char *test_inode_cache() {
+    llfs_file a, b;
+    llfs_inode i;
+    int loc;
+    llfs_error e = llfs_create_file("/icache.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/icache.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    inode_ref *ref = llfs_icache_find(loc);
+    unit_assert("Inode Not Cached", ref != NULL && ref->refs == 0);
+
+    e = llfs_open_file(&i, &a, loc);
+    unit_assert(llfs_strerror(e), e == EMPTY_FILE_ERROR);
+    e = llfs_open_file(&i, &b, loc);
+    unit_assert(llfs_strerror(e), e == EMPTY_FILE_ERROR);
+    unit_assert("Inode Not Shared", a.iref == ref && b.iref == ref && ref->refs == 2);
+
+    e = llfs_write("cached", sizeof(char), 6, &a);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Cached Inode Not Updated", ref->inode.file_size == 6);
+    e = llfs_seek(&b, LLFS_SEEK_END, 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Stale Inode", b.inode.file_size == 6 && b.pointer_byte_loc == 6);
+
+    llfs_destroy_file(&a);
+    llfs_destroy_file(&b);
+    unit_assert("Inode Still Referenced", ref->refs == 0);
+
+    e = llfs_delete("/icache.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Freed Inode Still Cached", llfs_icache_find(loc) == NULL);
+
+    pass();
+    return 0;
+}
+
+const char *test_dir_records() {
+    char path[300];
+    llfs_inode i;
+    int loc;
+
+    // Short names pack densely into one block
+    llfs_error e = llfs_create_file("/dense", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int j = 0; j < 60; j++) {
+        snprintf(path, sizeof(path), "/dense/s%02d", j);
+        e = llfs_create_file(path, FLAT);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    e = llfs_get_inode("/dense", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Short Names Not Packed", i.flags.dir_blocks == 1 && i.file_size == 60 * DIR_REC_LEN(3));
+    e = llfs_delete("/dense", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // Long names spill into a hashed directory which splits leaves to fit them
+    char name[LLFS_NAME_MAX + 2];
+    memset(name, 'n', sizeof(name));
+    name[200] = '\0';
+    e = llfs_create_file("/long", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int j = 0; j < 12; j++) {
+        snprintf(path, sizeof(path), "/long/%02d%s", j, name);
+        e = llfs_create_file(path, FLAT);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    e = llfs_get_inode("/long", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Directory Not Indexed", i.flags.dir_index == 1);
+
+    for (int j = 0; j < 12; j++) {
+        snprintf(path, sizeof(path), "/long/%02d%s", j, name);
+        e = llfs_get_inode(path, &i, &loc);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    name[200] = 'n';
+    name[LLFS_NAME_MAX] = '\0';
+    snprintf(path, sizeof(path), "/long/%s", name);
+    e = llfs_create_file(path, FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    name[LLFS_NAME_MAX] = 'n';
+    name[LLFS_NAME_MAX + 1] = '\0';
+    snprintf(path, sizeof(path), "/long/%s", name);
+    e = llfs_create_file(path, FLAT);
+    unit_assert(llfs_strerror(e), e == BAD_PATH_ERROR);
+
+    e = llfs_delete("/long", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_dir_compaction() {
+    const int num_files = 100;
+    char path[64];
+    llfs_inode i;
+    int loc;
+
+    llfs_error e = llfs_create_file("/churn", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int j = 0; j < 40; j++) {
+        snprintf(path, sizeof(path), "/churn/c%08d", j);
+        e = llfs_create_file(path, FLAT);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    // The first block is full so new entries skip it until something is removed from it
+    e = llfs_get_inode("/churn", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Full Block Not Skipped", i.flags.dir_blocks == 2 && i.flags.dir_free == 1);
+    e = llfs_delete("/churn/c00000003", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/churn", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Free Slot Not Recorded", i.flags.dir_free == 0);
+
+    for (int j = 40; j < num_files; j++) {
+        snprintf(path, sizeof(path), "/churn/c%08d", j);
+        e = llfs_create_file(path, FLAT);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    e = llfs_get_inode("/churn", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Directory Not Indexed", i.flags.dir_index == 1);
+    const int hashed_blocks = i.flags.dir_blocks;
+
+    // Removing most entries shrinks the directory back down to a single linear block
+    for (int j = 0; j < num_files; j++) {
+        if (j % 10 == 0 || j == 3) continue;
+        snprintf(path, sizeof(path), "/churn/c%08d", j);
+        e = llfs_delete(path, 0);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    e = llfs_get_inode("/churn", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Directory Not Compacted", hashed_blocks > 3 && i.flags.dir_blocks == 1 && i.flags.dir_index == 0);
+    unit_assert("Wrong Directory Size", i.file_size == num_files / 10 * DIR_REC_LEN(9));
+
+    llfs_dir dir;
+    dir_entry entry;
+    int count = 0;
+    e = llfs_dir_open("/churn", &dir);
+    unit_assert(llfs_strerror(e), e == 0);
+    while ((e = llfs_dir_next(&dir, &entry, NULL)) == 0) count++;
+    unit_assert(llfs_strerror(e), e == END_OF_FILE_ERROR);
+    unit_assert("Entries Lost", count == num_files / 10);
+    llfs_dir_close(&dir);
+
+    for (int j = 0; j < num_files; j++) {
+        snprintf(path, sizeof(path), "/churn/c%08d", j);
+        e = llfs_get_inode(path, &i, &loc);
+        unit_assert(llfs_strerror(e), e == (j % 10 == 0 ? 0 : FILE_NOT_FOUND_ERROR));
+        if (j % 10 == 0) continue;
+
+        e = llfs_create_file(path, FLAT);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    e = llfs_delete("/churn", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_delete_tree() {
+    const int depth = 8, width = 6;
+    char path[256];
+    llfs_inode i;
+    int loc;
+
+    // Rebuilding the tree over and over runs out of inodes if any are leaked by the delete
+    for (int round = 0; round < 6; round++) {
+        strcpy(path, "/tree");
+        llfs_error e = llfs_create_file(path, DIR);
+        unit_assert(llfs_strerror(e), e == 0);
+        for (int d = 0; d < depth; d++) {
+            const size_t len = strlen(path);
+            for (int j = 0; j < width; j++) {
+                snprintf(path + len, sizeof(path) - len, "/f%d", j);
+                e = llfs_create_file(path, FLAT);
+                unit_assert(llfs_strerror(e), e == 0);
+            }
+            snprintf(path + len, sizeof(path) - len, "/d%d", d);
+            e = llfs_create_file(path, DIR);
+            unit_assert(llfs_strerror(e), e == 0);
+        }
+
+        e = llfs_delete("/tree", 0);
+        unit_assert(llfs_strerror(e), e == NON_RECURSIVE_DELETE_ERROR);
+        e = llfs_get_inode(path, &i, &loc);
+        unit_assert("Tree Changed By Failed Delete", e == 0 || e == EMPTY_FILE_ERROR);
+
+        e = llfs_delete("/tree", 1);
+        unit_assert(llfs_strerror(e), e == 0);
+        e = llfs_get_inode("/tree", &i, &loc);
+        unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    }
+
+    pass();
+    return 0;
+}
+
+const char *test_deferred_checkpoint() {
+    char disk_copy[BLOCK_SIZE], data[16] = { 0 };
+    llfs_file f;
+    llfs_inode i;
+    int loc;
+
+    llfs_error e = llfs_create_file("/pending.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/pending.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_open_file(&i, &f, loc);
+    unit_assert(llfs_strerror(e), e == EMPTY_FILE_ERROR);
+    e = llfs_write("committed", sizeof(char), 9, &f);
+    unit_assert(llfs_strerror(e), e == 0);
+    llfs_destroy_file(&f);
+    e = journal_flush();
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // The commit only reached the log, the inode block at home is still the old one
+    disk_error de = disk_read_block(loc, disk_copy);
+    unit_assert(disk_strerror(de), de == 0);
+    unit_assert("Inode Written Home On Commit", ((llfs_inode *) disk_copy)->file_size != 9);
+
+    // Loading the disk again drops everything in memory as a crash would and replays the log
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/pending.txt", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Committed Write Lost", i.file_size == 9);
+    e = llfs_open_file(&i, &f, loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_bytes(&f, data, 9, 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Wrong Data", strcmp(data, "committed") == 0);
+    llfs_destroy_file(&f);
+
+    e = llfs_delete("/pending.txt", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    de = disk_read_block(1, disk_copy);    // The free block map
+    unit_assert(disk_strerror(de), de == 0);
+    char expected[BLOCK_SIZE];
+    e = journal_read_block(1, expected);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Sync Did Not Write Home", memcmp(disk_copy, expected, BLOCK_SIZE) == 0);
+
+    pass();
+    return 0;
+}
+
+uint32_t log_start() {
+    journal_super s;
+    char block[BLOCK_SIZE];
+    disk_read_block(JOURNAL_LOCATION, block);
+    memcpy(&s, block, sizeof(journal_super));
+    return s.log_start;
+}
+
+const char *test_group_commit() {
+    char *names[5] = { "f0", "f1", "f2", "f3", "f4" };
+    llfs_inode i;
+    int loc;
+
+    journal_set_commit_interval(60 * 1000);
+    llfs_error e = llfs_create_file("/group", DIR);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // The directory block, its inode, the inode map and the free block map are shared by every
+    // create so the group only logs them once, along with each new inode. The changes to both maps
+    // share one delta block.
+    const uint32_t start = log_start();
+    for (int j = 0; j < 5; j++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/group/%s", names[j]);
+        e = llfs_create_file(path, FLAT);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Blocks Not Absorbed", (log_start() + JOURNAL_LENGTH - 1 - start) % (JOURNAL_LENGTH - 1) == 2 + 5 + 1 + 2);
+
+    // A crash loses the operations which have not been committed, but never part of one
+    e = llfs_create_file("/group/lost", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/group/lost", &i, &loc);
+    unit_assert(llfs_strerror(e), e == FILE_NOT_FOUND_ERROR);
+    e = llfs_get_inode("/group/f4", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0 || e == EMPTY_FILE_ERROR);
+
+    e = llfs_delete("/group", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+    journal_set_commit_interval(JOURNAL_COMMIT_INTERVAL);
+
+    pass();
+    return 0;
+}
+
+const char *test_fwrite_error() {
+    llfs_file *f;
+
+    // Every write commits on its own so the failed commit is the write's
+    journal_set_commit_interval(0);
+    llfs_error e = llfs_touch("/unwritable");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/unwritable", &f);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    disk_error de = disk_unmount();
+    unit_assert(disk_strerror(de), de == 0);
+    e = llfs_fwrite("lost", sizeof(char), 4, f);
+    unit_assert("Commit Error Not Returned", e == DISK_ERROR);
+    de = disk_mount("system_disk");
+    unit_assert(disk_strerror(de), de == 0);
+
+    llfs_fclose(f);
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_delete("/unwritable", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    journal_set_commit_interval(JOURNAL_COMMIT_INTERVAL);
+
+    pass();
+    return 0;
+}
+
+const char *test_remount() {
+    char buffer[8] = { 0 };
+    llfs_file *f;
+    llfs_inode i;
+    int loc;
+
+    // Neither closing a file nor unmounting waits for the commit interval
+    journal_set_commit_interval(60 * 1000);
+    llfs_error e = llfs_touch("/remount");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fopen("/remount", &f);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fwrite("hello", sizeof(char), 5, f);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fclose(f);
+    unit_assert(llfs_strerror(e), e == 0);
+    disk_error de = disk_unmount();
+    unit_assert(disk_strerror(de), de == 0);
+    de = disk_mount("system_disk");
+    unit_assert(disk_strerror(de), de == 0);
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_fopen("/remount", &f);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_fread(buffer, sizeof(char), 5, f);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Closed File Lost", strcmp(buffer, "hello") == 0);
+    e = llfs_fclose(f);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    e = llfs_touch("/remount_touch");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = UnmountLLFS();
+    unit_assert(llfs_strerror(e), e == 0);
+    de = disk_mount("system_disk");
+    unit_assert(disk_strerror(de), de == 0);
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/remount_touch", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0 || e == EMPTY_FILE_ERROR);
+
+    e = llfs_delete("/remount", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_delete("/remount_touch", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    journal_set_commit_interval(JOURNAL_COMMIT_INTERVAL);
+
+    pass();
+    return 0;
+}
+
+const char *test_oversized_commit() {
+    char block[BLOCK_SIZE] = { 0 };
+    llfs_write_buffer first = { NULL, 0 }, last = { NULL, 0 };
+    const int max = journal_max_transaction();
+
+    // One block over the limit is refused whole instead of being split into transactions
+    llfs_error e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    const uint32_t start = log_start();
+    for (int i = 0; i <= max; i++) {
+        e = write_buffer_any(i % 2 == 0 ? &first : &last, block, BLOCK_SIZE, BLOCK_COUNT - 1 - i);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    e = llfs_commit_ordered(&first, &last);
+    unit_assert(llfs_strerror(e), e == TRANSACTION_TOO_LARGE_ERROR);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Part Of The Operation Logged", log_start() == start);
+
+    write_buffer_destroy(&first);
+    write_buffer_destroy(&last);
+    pass();
+    return 0;
+}
+
+/**
+ * Write count bytes of c to the start of a file
+ */
+llfs_error write_fill(char *path, char c, int count, llfs_inode *i, int *loc) {
+    char data[BLOCK_SIZE * 4];
+    llfs_file f;
+    memset(data, c, count);
+
+    llfs_error e = llfs_get_inode(path, i, loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) return e;
+    e = llfs_open_file(i, &f, *loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) return e;
+    e = llfs_write(data, sizeof(char), count, &f);
+    llfs_destroy_file(&f);
+    if (e != 0) return e;
+
+    return llfs_get_inode(path, i, loc);
+}
+
+const char *test_delete_rollback() {
+    unsigned char maps[3][BLOCK_SIZE], block[BLOCK_SIZE];
+    llfs_write_buffer w = { NULL, 0 }, fix = { NULL, 0 }, none = { NULL, 0 };
+    llfs_file f;
+    llfs_inode i;
+    int loc;
+
+    llfs_error e = llfs_create_dirs("/doomed/sub");
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_create_file("/doomed/big", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = write_fill("/doomed/big", 'b', BLOCK_SIZE * 3, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_create_file("/doomed/sub/x.txt", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_touch("/marker");
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // An entry for the root inode, which can not be freed, stops the walk after most of the
+    // tree has been freed in the maps
+    e = llfs_get_inode("/doomed/sub", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    char saved[BLOCK_SIZE];
+    e = journal_read_block(i.direct[0], saved);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_open_file(&i, &f, loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    dir_entry d = { 1, "an entry with a name too long to be cached" };
+    e = llfs_dir_append(&w, &f, d);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int j = 0; j < w.num_blocks; j++) {
+        if (w.blocks[j].block_num != i.direct[0]) continue;
+        e = write_buffer_any(&fix, w.blocks[j].block_data, BLOCK_SIZE, i.direct[0]);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    write_buffer_destroy(&w);
+    llfs_destroy_file(&f);
+    e = llfs_commit_ordered(&fix, &none);
+    unit_assert(llfs_strerror(e), e == 0);
+    write_buffer_destroy(&fix);
+    fix = (llfs_write_buffer) { NULL, 0 };
+
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_read_block(FREE_BLOCK_LOC, (char *) maps[0]);
+    unit_assert(llfs_strerror(e), e == 0);
+    for (int j = 0; j < 2; j++) {
+        e = journal_read_block(INODE_MAP_LOC + j, (char *) maps[j + 1]);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    e = llfs_delete("/doomed", 1);
+    unit_assert(llfs_strerror(e), e == INODE_FREE_ERROR);
+    e = llfs_get_inode("/doomed/big", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // The next commit writes the maps, which must still hold everything the delete freed
+    e = llfs_delete("/marker", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_read_block(FREE_BLOCK_LOC, (char *) block);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Tree Blocks Freed", count_bits(block) == count_bits(maps[0]) + 1);
+    int before = 0, after = 0;
+    for (int j = 0; j < 2; j++) {
+        e = journal_read_block(INODE_MAP_LOC + j, (char *) block);
+        unit_assert(llfs_strerror(e), e == 0);
+        for (int k = 0; k < BLOCK_SIZE / 4; k++) {
+            before += ((uint32_t *) maps[j + 1])[k] != 0;
+            after += ((uint32_t *) block)[k] != 0;
+        }
+    }
+    unit_assert("Tree Inodes Freed", after == before - 1);
+
+    e = llfs_get_inode("/doomed/sub", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = write_buffer_any(&fix, saved, BLOCK_SIZE, i.direct[0]);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_commit_ordered(&fix, &none);
+    unit_assert(llfs_strerror(e), e == 0);
+    write_buffer_destroy(&fix);
+    e = llfs_delete("/doomed", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_journal_modes() {
+    char block[BLOCK_SIZE], expected[BLOCK_SIZE];
+    llfs_inode i;
+    int loc;
+
+    llfs_error e = llfs_create_file("/modes", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_set_mode(JOURNAL_ORDERED);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_set_mode((journal_mode) 7);
+    unit_assert(llfs_strerror(e), e == INVALID_OPTION_ERROR);
+
+    // Ordered data is home before the transaction which links it to the file commits
+    const uint32_t start = log_start();
+    e = write_fill("/modes", 'o', BLOCK_SIZE * 4, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    disk_error de = disk_read_block(i.direct[3], block);
+    unit_assert(disk_strerror(de), de == 0);
+    memset(expected, 'o', BLOCK_SIZE);
+    unit_assert("Ordered Data Not Written Home", memcmp(block, expected, BLOCK_SIZE) == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    // Only the inode and the free block map are logged, with a descriptor and commit block
+    unit_assert("Data Logged", (log_start() + JOURNAL_LENGTH - 1 - start) % (JOURNAL_LENGTH - 1) == 4);
+
+    // The mode belongs to the volume and survives loading it again
+    e = journal_set_mode(JOURNAL_WRITEBACK);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = write_fill("/modes", 'w', BLOCK_SIZE, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_flush();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Mode Not Kept", journal_get_mode() == JOURNAL_WRITEBACK);
+    e = journal_read_block(i.direct[0], block);
+    unit_assert(llfs_strerror(e), e == 0);
+    memset(expected, 'w', BLOCK_SIZE);
+    unit_assert("Writeback Data Lost", memcmp(block, expected, BLOCK_SIZE) == 0);
+
+    // A copy logged before switching modes must never land on top of newer in place data
+    e = journal_set_mode(JOURNAL_DATA);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = write_fill("/modes", 'd', BLOCK_SIZE, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_set_mode(JOURNAL_ORDERED);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = write_fill("/modes", 'n', BLOCK_SIZE, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    de = disk_read_block(i.direct[0], block);
+    unit_assert(disk_strerror(de), de == 0);
+    memset(expected, 'n', BLOCK_SIZE);
+    unit_assert("Stale Logged Copy Written Home", memcmp(block, expected, BLOCK_SIZE) == 0);
+
+    e = journal_set_mode(JOURNAL_DATA);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_delete("/modes", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+typedef struct walk_count {
+    pthread_mutex_t lock;
+    int files;
+    int dirs;
+    int found;
+} walk_count;
+
+llfs_error count_entry(const char *path, const llfs_inode *inode, void *arg) {
+    walk_count *c = (walk_count *) arg;
+    pthread_mutex_lock(&c->lock);
+    if (inode->flags.type == DIR) c->dirs++; else c->files++;
+    if (strcmp(path, "/walk/d1/d2/f3") == 0) c->found++;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+llfs_error stop_walk(const char *path, const llfs_inode *inode, void *arg) {
+    return INVALID_OPTION_ERROR;
+}
+
+const char *test_walk_tree() {
+    char *names[5] = { "f0", "f1", "f2", "f3", "f4" };
+    char *dirs[4] = { "/walk/d1/d2", "/walk/d1/d3", "/walk/d4", "/walk/d5/d6/d7" };
+
+    llfs_error e;
+    for (int i = 0; i < 4; i++) {
+        e = llfs_create_dirs(dirs[i]);
+        unit_assert(llfs_strerror(e), e == 0);
+        e = llfs_create_many(dirs[i], names, 5, FLAT, NULL);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    // Every entry is seen once however many threads share the walk
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        walk_count c = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+        e = llfs_walk_tree("/walk/", count_entry, &c, threads);
+        unit_assert(llfs_strerror(e), e == 0);
+        unit_assert("Wrong Number Of Files", c.files == 20);
+        unit_assert("Wrong Number Of Directories", c.dirs == 7);
+        unit_assert("Path Not Built", c.found == 1);
+    }
+
+    e = llfs_walk_tree("/walk", stop_walk, NULL, 4);
+    unit_assert(llfs_strerror(e), e == INVALID_OPTION_ERROR);
+    e = llfs_walk_tree("/walk/d4/f0", stop_walk, NULL, 4);
+    unit_assert(llfs_strerror(e), e == BAD_PATH_ERROR);
+    e = llfs_walk_tree("/walk", count_entry, NULL, 0);
+    unit_assert(llfs_strerror(e), e == INVALID_OPTION_ERROR);
+
+    e = llfs_delete("/walk", 1);
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_external_journal() {
+    char block[BLOCK_SIZE], expected[BLOCK_SIZE];
+    journal_super js;
+    llfs_inode i;
+    int loc;
+
+    llfs_error e = InitLLFSExternalJournal("system_journal_disk", 40);
+    unit_assert(llfs_strerror(e), e == 0);
+    disk_error de = disk_journal_read_block(0, block);
+    unit_assert(disk_strerror(de), de == 0);
+    memcpy(&js, block, sizeof(journal_super));
+    unit_assert("Journal Not On Image", js.block_start == 0 && js.block_count == 40);
+
+    // The root directory takes the journal's place on the disk
+    e = llfs_get_inode("/", &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0 || e == EMPTY_FILE_ERROR);
+    unit_assert("Journal Blocks Kept", loc == JOURNAL_LOCATION);
+
+    e = llfs_create_file("/external", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = write_fill("/external", 'x', BLOCK_SIZE * 2, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = journal_flush();
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // A crash is recovered from the log on the journal image
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+    de = disk_read_block(i.direct[1], block);
+    unit_assert(disk_strerror(de), de == 0);
+    memset(expected, 'x', BLOCK_SIZE);
+    unit_assert("External Log Not Replayed", memcmp(block, expected, BLOCK_SIZE) == 0);
+
+    // The disk only mounts with the journal it was formatted with
+    de = disk_journal_read_block(0, block);
+    unit_assert(disk_strerror(de), de == 0);
+    block[offsetof(journal_super, uuid)] ^= 1;
+    de = disk_journal_write_block(0, block);
+    unit_assert(disk_strerror(de), de == 0);
+    e = llfs_load();
+    unit_assert("Foreign Journal Accepted", e == JOURNAL_ERROR);
+    block[offsetof(journal_super, uuid)] ^= 1;
+    de = disk_journal_write_block(0, block);
+    unit_assert(disk_strerror(de), de == 0);
+
+    de = disk_unmount_journal();
+    unit_assert(disk_strerror(de), de == 0);
+    e = llfs_load();
+    unit_assert("Loaded Without Journal", e == DISK_ERROR);
+    de = disk_mount_journal("system_journal_disk");
+    unit_assert(disk_strerror(de), de == 0);
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // Formatting again brings the journal back inside the disk
+    e = llfs_init();
+    unit_assert(llfs_strerror(e), e == 0);
+    de = disk_unmount_journal();
+    unit_assert(disk_strerror(de), de == 0);
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+
+    pass();
+    return 0;
+}
+
+const char *test_ordered_reuse() {
+    char block[BLOCK_SIZE], expected[BLOCK_SIZE];
+    llfs_inode i;
+    int loc;
+
+    journal_set_commit_interval(60 * 1000);
+    llfs_error e = journal_set_mode(JOURNAL_ORDERED);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_create_file("/reuse_a", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = write_fill("/reuse_a", 'A', BLOCK_SIZE, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_sync();
+    unit_assert(llfs_strerror(e), e == 0);
+
+    // The new file gets the block the delete released before the delete commits
+    const int freed = i.direct[0];
+    e = llfs_delete("/reuse_a", 0);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_create_file("/reuse_b", FLAT);
+    unit_assert(llfs_strerror(e), e == 0);
+    e = write_fill("/reuse_b", 'B', BLOCK_SIZE, &i, &loc);
+    unit_assert(llfs_strerror(e), e == 0);
+    unit_assert("Freed Block Not Reused", i.direct[0] == freed);
+
+    // After a crash a file which still has the block never holds the other file's data
+    e = llfs_load();
+    unit_assert(llfs_strerror(e), e == 0);
+    e = llfs_get_inode("/reuse_a", &i, &loc);
+    if (e != FILE_NOT_FOUND_ERROR) {
+        unit_assert(llfs_strerror(e), e == 0);
+        e = journal_read_block(i.direct[0], block);
+        unit_assert(llfs_strerror(e), e == 0);
+        memset(expected, 'A', BLOCK_SIZE);
+        unit_assert("Committed File Holds New Data", memcmp(block, expected, BLOCK_SIZE) == 0);
+        e = llfs_delete("/reuse_a", 0);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+
+    e = llfs_get_inode("/reuse_b", &i, &loc);
+    if (e != FILE_NOT_FOUND_ERROR) {
+        e = llfs_delete("/reuse_b", 0);
+        unit_assert(llfs_strerror(e), e == 0);
+    }
+    e = journal_set_mode(JOURNAL_DATA);
+    unit_assert(llfs_strerror(e), e == 0);
+    journal_set_commit_interval(JOURNAL_COMMIT_INTERVAL);
+
+    pass();
+    return 0;
+}
+
 int main() {
     disk_mount("system_disk");
 
@@ -307,7 +1565,30 @@ int main() {
         test_open_file,
         test_write_file,
         test_open_old_file,
-        test_delete_file
+        test_inline_file,
+        test_readahead,
+        test_clone_file,
+        test_clone_rollback,
+        test_create_many_rollback,
+        test_hashed_dir,
+        test_long_names,
+        test_dentry_cache,
+        test_uncommitted_names,
+        test_inode_cache,
+        test_dir_records,
+        test_dir_compaction,
+        test_delete_tree,
+        test_delete_rollback,
+        test_walk_tree,
+        test_deferred_checkpoint,
+        test_group_commit,
+        test_remount,
+        test_fwrite_error,
+        test_oversized_commit,
+        test_journal_modes,
+        test_ordered_reuse,
+        test_delete_file,
+        test_external_journal
     };
 
     const char *msg = run_tests(tests, sizeof(tests) / sizeof(unit));
@@ -17,6 +17,7 @@ static const char *DISK_ERROR_STRING[] = {
 };
 
 FILE *disk;
+FILE *journal_disk;     // Optional second image holding an external journal
 
 const char *disk_strerror(disk_error e) {
     return DISK_ERROR_STRING[e];
@@ -46,6 +47,26 @@ disk_error disk_unmount() {
     return DISK_NOT_LOADED;
 }
 
+/**
+ * Read a single block from an image
+ * @param image - The image to read from
+ * @param block_num - The id of the block to read to
+ * @param block - Buffer to store block data
+ * @return 0 for success, otherwise error
+ */
+disk_error disk_read_from(FILE *image, int block_num, char *block) {
+    if (image == NULL) return DISK_NOT_LOADED;
+    if (block_num >= BLOCK_COUNT || block_num < 0) return BLOCK_OUT_OF_BOUNDS;
+
+    int res = fseek(image, BLOCK_SIZE * block_num, SEEK_SET);
+    if (res != 0) return DISK_SEEK_ERROR;
+
+    res = fread(block, sizeof(char), BLOCK_SIZE, image);
+    if (res != BLOCK_SIZE) return DISK_WRITE_ERROR;
+
+    return 0;
+}
+
 /**
  * Read a single block from the disk
  * @param block_num - The id of the block to read to
@@ -53,26 +74,38 @@ disk_error disk_unmount() {
  * @return 0 for success, otherwise error
  */
 disk_error disk_read_block(int block_num, char *block) {
+    return disk_read_from(disk, block_num, block);
+}
+
+/**
+ * Read a run of consecutive blocks from the disk with a single read
+ * @param block_num - The id of the first block to read
+ * @param count - The number of blocks to read
+ * @param blocks - Buffer of count * BLOCK_SIZE bytes to store the block data
+ * @return 0 for success, otherwise error
+ */
+disk_error disk_read_blocks(int block_num, int count, char *blocks) {
     if (disk == NULL) return DISK_NOT_LOADED;
-    if (block_num >= BLOCK_COUNT || block_num < 0) return BLOCK_OUT_OF_BOUNDS;
+    if (block_num + count > BLOCK_COUNT || block_num < 0 || count < 0) return BLOCK_OUT_OF_BOUNDS;
 
     int res = fseek(disk, BLOCK_SIZE * block_num, SEEK_SET);
     if (res != 0) return DISK_SEEK_ERROR;
 
-    res = fread(block, sizeof(char), BLOCK_SIZE, disk);
-    if (res != BLOCK_SIZE) return DISK_WRITE_ERROR;
+    res = fread(blocks, sizeof(char), BLOCK_SIZE * count, disk);
+    if (res != BLOCK_SIZE * count) return DISK_WRITE_ERROR;
 
     return 0;
 }
 
 /**
- * Write a single block to the disk
+ * Write a single block to an image
+ * @param image - The image to write to
  * @param block_num - The id of the block to write
  * @param block - Block data to be written
  * @return 0 for success, otherwise error
  */
-disk_error disk_write_block(int block_num, char *block) {
-    if (disk == NULL) {
+disk_error disk_write_to(FILE *image, int block_num, char *block) {
+    if (image == NULL) {
         return DISK_NOT_LOADED;
     }
 
@@ -80,15 +113,45 @@ disk_error disk_write_block(int block_num, char *block) {
         return BLOCK_OUT_OF_BOUNDS;
     }
 
-    int res = fseek(disk, BLOCK_SIZE * block_num, SEEK_SET);
+    int res = fseek(image, BLOCK_SIZE * block_num, SEEK_SET);
     if (res != 0) return DISK_SEEK_ERROR;
 
-    res = fwrite(block, sizeof(char), BLOCK_SIZE, disk);
+    res = fwrite(block, sizeof(char), BLOCK_SIZE, image);
     if (res != BLOCK_SIZE) return DISK_WRITE_ERROR;
 
     return 0;
 }
 
+/**
+ * Write a single block to the disk
+ * @param block_num - The id of the block to write
+ * @param block - Block data to be written
+ * @return 0 for success, otherwise error
+ */
+disk_error disk_write_block(int block_num, char *block) {
+    return disk_write_to(disk, block_num, block);
+}
+
+/**
+ * Read a single block from the journal image
+ * @param block_num - The id of the block to read to
+ * @param block - Buffer to store block data
+ * @return 0 for success, otherwise error
+ */
+disk_error disk_journal_read_block(int block_num, char *block) {
+    return disk_read_from(journal_disk, block_num, block);
+}
+
+/**
+ * Write a single block to the journal image
+ * @param block_num - The id of the block to write
+ * @param block - Block data to be written
+ * @return 0 for success, otherwise error
+ */
+disk_error disk_journal_write_block(int block_num, char *block) {
+    return disk_write_to(journal_disk, block_num, block);
+}
+
 disk_error disk_init(FILE *disk_file) {
     const char *buffer[BLOCK_SIZE] = { 0 };
 
@@ -104,15 +167,12 @@ disk_error disk_init(FILE *disk_file) {
 }
 
 /**
- * Mount a disk to use for reading and writing to
- * @param disk_name - Name of disk to be mounted
+ * Open an image, creating an empty one if it does not exist
+ * @param disk_name - Name of the image
+ * @param image - Set to the open image
  * @return 0 for success, otherwise error
  */
-disk_error disk_mount(char *disk_name) {
-    if (disk != NULL) {
-        return DISK_ALREADY_LOADED;
-    }
-
+disk_error disk_open(char *disk_name, FILE **image) {
     FILE *disk_file = fopen(disk_name, "rb+");
     if (disk_file == NULL) {
         disk_file = fopen(disk_name, "wb+x");
@@ -122,9 +182,55 @@ disk_error disk_mount(char *disk_name) {
         }
 
         int res = disk_init(disk_file);
-        if (res != 0) return res;
+        if (res != 0) { fclose(disk_file); return res; }
     }
 
-    disk = disk_file;
+    *image = disk_file;
+    return 0;
+}
+
+/**
+ * Mount a disk to use for reading and writing to
+ * @param disk_name - Name of disk to be mounted
+ * @return 0 for success, otherwise error
+ */
+disk_error disk_mount(char *disk_name) {
+    if (disk != NULL) {
+        return DISK_ALREADY_LOADED;
+    }
+
+    return disk_open(disk_name, &disk);
+}
+
+/**
+ * Check if there is a journal image currently mounted
+ * @return disk_error
+ */
+int disk_journal_is_mounted() {
+    return journal_disk == NULL ? 0 : 1;
+}
+
+/**
+ * Mount a second image to hold the journal, so the log is written apart from the disk
+ * @param disk_name - Name of the journal image to be mounted
+ * @return 0 for success, otherwise error
+ */
+disk_error disk_mount_journal(char *disk_name) {
+    if (journal_disk != NULL) {
+        return DISK_ALREADY_LOADED;
+    }
+
+    return disk_open(disk_name, &journal_disk);
+}
+
+/**
+ * Unmount the journal image which is currently mounted
+ * @return disk_error
+ */
+disk_error disk_unmount_journal() {
+    if (journal_disk == NULL) return DISK_NOT_LOADED;
+    if (fclose(journal_disk) != 0) return DISK_NOT_LOADED;
+
+    journal_disk = NULL;
     return 0;
 }
@@ -24,7 +24,14 @@ int disk_is_mounted();
 disk_error disk_unmount();
 
 disk_error disk_read_block(int block_num, char *block);
+disk_error disk_read_blocks(int block_num, int count, char *blocks);
 disk_error disk_write_block(int block_num, char *block);
 disk_error disk_mount(char *disk_name);
 
+int disk_journal_is_mounted();
+disk_error disk_mount_journal(char *disk_name);
+disk_error disk_unmount_journal();
+disk_error disk_journal_read_block(int block_num, char *block);
+disk_error disk_journal_write_block(int block_num, char *block);
+
 #endif
\ No newline at end of file
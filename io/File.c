@@ -4,28 +4,55 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "system.h"
 #include "File.h"
+#include "../disk/disk.h"
 
-// This is small because the disk is very small and we need to ensure
-// that the journal does not wrap around and write over itself
-const int MAX_WRITE_SIZE = 2048;
+// Blocks of a write transaction which are not file data: the inode, indirect blocks, the free
+// block map, reference counts and the partly written blocks at either end
+const int WRITE_OVERHEAD_BLOCKS = 6;
+
+/**
+ * The most bytes which can be written in one transaction, which depends on the journal length
+ */
+int llfs_max_write() {
+    return (journal_max_transaction() - WRITE_OVERHEAD_BLOCKS) * BLOCK_SIZE;
+}
 
 llfs_error InitLLFS() {
     return llfs_init();
 }
 
+llfs_error InitLLFSJournal(int journal_length) {
+    return llfs_format(journal_length);
+}
+
+llfs_error UnmountLLFS() {
+    return llfs_unmount();
+}
+
+llfs_error InitLLFSExternalJournal(char *journal_image, int journal_length) {
+    if (disk_journal_is_mounted()) disk_unmount_journal();
+    if (disk_mount_journal(journal_image) != 0) return DISK_ERROR;
+    return llfs_format_external(journal_length);
+}
+
 llfs_error llfs_fseek(llfs_file *file, llfs_seek_opt p, int offset) {
     return llfs_seek(file, (llfs_seek_pos) p, offset);
 }
 
 llfs_error llfs_fopen(char *path, llfs_file **file) {
+    return llfs_openat(NULL, path, file);
+}
+
+llfs_error llfs_openat(llfs_dir *dir, char *path, llfs_file **file) {
     llfs_file *f = (llfs_file *) calloc(1, sizeof(llfs_file));
     if (f == NULL) return MEMORY_ALLOC_ERROR;
 
     int loc;
     llfs_inode i;
-    llfs_error e = llfs_get_inode(path, &i, &loc);
+    llfs_error e = dir == NULL ? llfs_get_inode(path, &i, &loc) : llfs_get_inode_at(dir->inode_loc, path, &i, &loc);
     if (e != 0) {
         if (e == EMPTY_FILE_ERROR) e = FILE_NOT_FOUND_ERROR;
         *file = NULL;
@@ -49,7 +76,10 @@ llfs_error llfs_fclose(llfs_file *file) {
     if (file == NULL) return 0;
     llfs_error e = llfs_destroy_file(file);
     free(file);
-    return e;
+
+    // Closing a file commits whatever is still grouped in the running transaction
+    llfs_error fe = journal_flush();
+    return e != 0 ? e : fe;
 }
 
 llfs_error llfs_mkdir(char *path) {
@@ -60,6 +90,22 @@ llfs_error llfs_touch(char *path) {
     return llfs_create_file(path, FLAT);
 }
 
+llfs_error llfs_touch_many(char *dir, char **names, int count) {
+    return llfs_create_many(dir, names, count, FLAT, NULL);
+}
+
+llfs_error llfs_mkdir_p(char *path) {
+    return llfs_create_dirs(path);
+}
+
+llfs_error llfs_clone(char *src, char *dst) {
+    return llfs_clone_file(src, dst);
+}
+
+llfs_error llfs_rename(char *old_path, char *new_path) {
+    return llfs_rename_file(old_path, new_path);
+}
+
 llfs_error llfs_fread(char *buffer, int size, int count, llfs_file *file) {
     if (file == NULL) return FILE_NOT_ALLOCATED_ERROR;
     return llfs_get_bytes(file, buffer, size * count, 0);
@@ -68,24 +114,132 @@ llfs_error llfs_fread(char *buffer, int size, int count, llfs_file *file) {
 llfs_error llfs_fwrite(char *content, int size, int count, llfs_file *file) {
     if (file == NULL) return FILE_NOT_ALLOCATED_ERROR;
     int left_to_write = count * size;
+    const int max_write = llfs_max_write();
 
-    llfs_error e;
+    llfs_error e = 0;
     while (left_to_write > 0) {
-        if (left_to_write >= MAX_WRITE_SIZE) {
-            e = llfs_write(content, 1, MAX_WRITE_SIZE, file);
+        if (left_to_write >= max_write) {
+            e = llfs_write(content, 1, max_write, file);
             if (e != 0) break;
         } else {
             e = llfs_write(content, 1, left_to_write, file);
             if (e != 0) break;
         }
 
-        left_to_write -= MAX_WRITE_SIZE;
-        content += MAX_WRITE_SIZE;
+        left_to_write -= max_write;
+        content += max_write;
     }
 
+    return e;
+}
+
+llfs_error llfs_freadv(llfs_iovec *iov, int iovcnt, llfs_file *file) {
+    if (file == NULL) return FILE_NOT_ALLOCATED_ERROR;
+    return llfs_readv(iov, iovcnt, file);
+}
+
+llfs_error llfs_fwritev(llfs_iovec *iov, int iovcnt, llfs_file *file) {
+    if (file == NULL) return FILE_NOT_ALLOCATED_ERROR;
+
+    int total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len < 0) return INVALID_OPTION_ERROR;
+        total += iov[i].len;
+    }
+
+    // The whole vector has to fit in one transaction
+    if (total > llfs_max_write()) return EXCEEDED_MAX_BUFFER_SIZE;
+    return llfs_writev(iov, iovcnt, file);
+}
+
+llfs_error llfs_fadvise(llfs_file *file, int offset, int len, llfs_fadvise_opt advice) {
+    if (file == NULL) return FILE_NOT_ALLOCATED_ERROR;
+    return llfs_advise(file, offset, len, (llfs_advice) advice);
+}
+
+llfs_error llfs_ftruncate(llfs_file *file, int new_size) {
+    if (file == NULL) return FILE_NOT_ALLOCATED_ERROR;
+    return llfs_truncate(file, new_size);
+}
+
+llfs_error llfs_opendir(char *path, llfs_dir **dir) {
+    llfs_dir *d = (llfs_dir *) calloc(1, sizeof(llfs_dir));
+    if (d == NULL) return MEMORY_ALLOC_ERROR;
+
+    llfs_error e = llfs_dir_open(path, d);
+    if (e != 0) {
+        *dir = NULL;
+        free(d);
+        return e;
+    }
+
+    *dir = d;
+    return 0;
+}
+
+llfs_error llfs_readdir(llfs_dir *dir, llfs_dirent *entry) {
+    if (dir == NULL) return FILE_NOT_ALLOCATED_ERROR;
+
+    dir_entry next;
+    unwrap(llfs_dir_next(dir, &next, NULL));
+    memcpy(entry->name, next.name, sizeof(entry->name));
+    entry->type = LLFS_DT_UNKNOWN;
+    entry->size = -1;
+    return 0;
+}
+
+llfs_error llfs_readdir_plus(llfs_dir *dir, llfs_dirent *entry) {
+    if (dir == NULL) return FILE_NOT_ALLOCATED_ERROR;
+
+    dir_entry next;
+    llfs_inode inode;
+    unwrap(llfs_dir_next(dir, &next, &inode));
+    memcpy(entry->name, next.name, sizeof(entry->name));
+    entry->type = (llfs_dirent_type) inode.flags.type;
+    entry->size = (int) inode.file_size;
+    return 0;
+}
+
+llfs_error llfs_closedir(llfs_dir *dir) {
+    if (dir == NULL) return 0;
+    llfs_dir_close(dir);
+    free(dir);
     return 0;
 }
 
 llfs_error llfs_rm(char *path, int recursive) {
     return llfs_delete(path, recursive);
+}
+
+llfs_error llfs_mkdirat(llfs_dir *dir, char *path) {
+    if (dir == NULL) return FILE_NOT_ALLOCATED_ERROR;
+    return llfs_create_at(dir->inode_loc, path, DIR);
+}
+
+llfs_error llfs_touchat(llfs_dir *dir, char *path) {
+    if (dir == NULL) return FILE_NOT_ALLOCATED_ERROR;
+    return llfs_create_at(dir->inode_loc, path, FLAT);
+}
+
+llfs_error llfs_rmat(llfs_dir *dir, char *path, int recursive) {
+    if (dir == NULL) return FILE_NOT_ALLOCATED_ERROR;
+    return llfs_delete_at(dir->inode_loc, path, recursive);
+}
+
+llfs_error llfs_walk(char *root, llfs_walk_fn fn, void *arg, int nthreads) {
+    return llfs_walk_tree(root, fn, arg, nthreads);
+}
+
+llfs_error llfs_fsync() {
+    return llfs_sync();
+}
+
+llfs_error llfs_set_commit_interval(int ms) {
+    if (ms < 0) return INVALID_OPTION_ERROR;
+    journal_set_commit_interval(ms);
+    return 0;
+}
+
+llfs_error llfs_journal_mode(llfs_journal_opt mode) {
+    return journal_set_mode((journal_mode) mode);
 }
\ No newline at end of file
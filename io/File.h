@@ -9,12 +9,69 @@
 
 typedef struct llfs_file llfs_file;
 
+typedef struct llfs_dir llfs_dir;
+
+typedef struct llfs_inode llfs_inode;
+
+// Called for every entry of a tree walk, returning an error stops the walk
+typedef llfs_error (*llfs_walk_fn)(const char *path, const llfs_inode *inode, void *arg);
+
+// Most worker threads a tree walk can use
+#define LLFS_WALK_MAX_THREADS 64
+
+// Type of a directory entry, mirrors file_type
+typedef enum llfs_dirent_type {
+    LLFS_DT_FLAT,
+    LLFS_DT_DIR,
+    LLFS_DT_UNKNOWN
+} llfs_dirent_type;
+
+// Longest file name in bytes, not including the terminator
+#define LLFS_NAME_MAX 255
+
+// One entry of a directory listing
+typedef struct llfs_dirent {
+    char name[LLFS_NAME_MAX + 1];
+    llfs_dirent_type type;      // Only known when read with llfs_readdir_plus
+    int size;                   // Size in bytes, only known when read with llfs_readdir_plus
+} llfs_dirent;
+
+// One buffer of a vectored read or write
+typedef struct llfs_iovec {
+    char *base;     // Start of the buffer
+    int len;        // Number of bytes in the buffer
+} llfs_iovec;
+
 /**
  * Format the LLFS file system.
  * @return - llfs_error - An error or 0 for success
  */
 llfs_error InitLLFS();
 
+/**
+ * Format the LLFS file system with a longer journal. A longer journal allows longer transactions,
+ * so large writes are committed in fewer pieces, at the cost of blocks for files.
+ * @param journal_length - Blocks in the journal, from JOURNAL_LENGTH (20) to JOURNAL_MAX_LENGTH (1024)
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error InitLLFSJournal(int journal_length);
+
+/**
+ * Commit and checkpoint every change, then unmount the disk and the journal image if there is one.
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error UnmountLLFS();
+
+/**
+ * Format the LLFS file system with its journal on a separate image, so commits are written
+ * apart from the file data. The journal image is linked to the disk and has to be mounted with
+ * disk_mount_journal before the disk is loaded again.
+ * @param journal_image - Name of the journal image, created if it does not exist
+ * @param journal_length - Blocks in the journal, from JOURNAL_LENGTH (20) to JOURNAL_MAX_LENGTH (1024)
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error InitLLFSExternalJournal(char *journal_image, int journal_length);
+
 // This is being redefined wit a new name
 typedef enum llfs_seek_opt {
     LLFS_FSEEK_START,
@@ -22,6 +79,22 @@ typedef enum llfs_seek_opt {
     LLFS_FSEEK_SET
 } llfs_seek_opt;
 
+// Access pattern hints, mirrors llfs_advice
+typedef enum llfs_fadvise_opt {
+    LLFS_FADV_NORMAL,
+    LLFS_FADV_SEQUENTIAL,
+    LLFS_FADV_RANDOM,
+    LLFS_FADV_WILLNEED,
+    LLFS_FADV_DONTNEED
+} llfs_fadvise_opt;
+
+// How file data is journaled, mirrors journal_mode
+typedef enum llfs_journal_opt {
+    LLFS_JOURNAL_DATA,
+    LLFS_JOURNAL_ORDERED,
+    LLFS_JOURNAL_WRITEBACK
+} llfs_journal_opt;
+
 /**
  * Seek to a position in a file
  * @param file - A file to seek a new position in
@@ -64,6 +137,46 @@ llfs_error llfs_mkdir(char *path);
  */
 llfs_error llfs_touch(char *path);
 
+/**
+ * Create many flat files in one existing directory. The directory is looked up once and the files
+ * are committed in batches, which is much faster than calling llfs_touch for each of them. If a
+ * name is invalid or already exists the files before it are still created.
+ * @param dir - Absolute path to the directory
+ * @param names - The names of the new files, without any path
+ * @param count - The number of names
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_touch_many(char *dir, char **names, int count);
+
+/**
+ * Make a directory along with any parent directories which do not exist yet. It is not an error
+ * if the directory already exists.
+ * @param path - Absolute path of the directory
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_mkdir_p(char *path);
+
+/**
+ * Create a copy of a flat file without copying its data. The copy shares the data blocks of the
+ * source until either file writes to a block, which then gets a copy of its own. Both paths must
+ * be absolute and the directory containing the copy must exist.
+ * @param src - Absolute path to the file to copy
+ * @param dst - Absolute path to the new file
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_clone(char *src, char *dst);
+
+/**
+ * Move a file or directory to a new path, which may be in a different directory. The data is not
+ * copied and the move is a single journal transaction, so after a crash the file is found at
+ * exactly one of the two paths. A flat file already at the new path is replaced, which allows
+ * updating a file by writing a temporary file and renaming it over the original.
+ * @param old_path - Absolute path to the file to move
+ * @param new_path - Absolute path to move the file to
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_rename(char *old_path, char *new_path);
+
 /**
  * Reads from the file pointer provided. If the pointer is null an error will be returned.
  * @param buffer - Buffer will store the data
@@ -75,8 +188,15 @@ llfs_error llfs_touch(char *path);
 llfs_error llfs_fread(char *buffer, int size, int count, llfs_file *file);
 
 /**
- * There us a maximum buffer size of 2kb. If exceeded an error will be returned. If the file pointer
- * is null an error will be returned.
+ * The most bytes llfs_fwrite commits in one journal transaction, 5kb with the default journal.
+ * @return - The number of bytes, which grows with the journal length
+ */
+int llfs_max_write();
+
+/**
+ * Writes any amount of data. Anything larger than llfs_max_write() is split into several journal
+ * transactions, so a failure part way leaves the parts before it written. If the file pointer is
+ * null an error will be returned.
  * @param content - Content store the data being written
  * @param size - The size of a single item being written
  * @param count - The number of items being written
@@ -85,6 +205,89 @@ llfs_error llfs_fread(char *buffer, int size, int count, llfs_file *file);
  */
 llfs_error llfs_fwrite(char *content, int size, int count, llfs_file *file);
 
+/**
+ * Read from the file pointer into each of the buffers in order. Reading stops with an error
+ * if the end of the file is reached.
+ * @param iov - The buffers to fill
+ * @param iovcnt - The number of buffers
+ * @param file - The file to read data from
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_freadv(llfs_iovec *iov, int iovcnt, llfs_file *file);
+
+/**
+ * Write each of the buffers to the file in order as a single journal transaction, so either all
+ * of them are written or none are. The buffers can add up to llfs_max_write() bytes, if exceeded
+ * an error will be returned.
+ * @param iov - The buffers to write
+ * @param iovcnt - The number of buffers
+ * @param file - The file to write to
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_fwritev(llfs_iovec *iov, int iovcnt, llfs_file *file);
+
+/**
+ * Declare how a file is going to be accessed. Reads are sequential by default, which reads ahead
+ * a growing window of blocks while a file is read in order. SEQUENTIAL always reads ahead the largest
+ * window and RANDOM disables read ahead. WILLNEED reads the range into memory now and DONTNEED
+ * releases the range from memory.
+ * @param file - The file the hint applies to
+ * @param offset - The first byte of the range for WILLNEED and DONTNEED
+ * @param len - The length of the range in bytes, 0 for until the end of the file
+ * @param advice - The access pattern hint
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_fadvise(llfs_file *file, int offset, int len, llfs_fadvise_opt advice);
+
+/**
+ * Shrink a file to the size provided. All of the blocks past the new end of the file, including
+ * indirect blocks which become empty, are released in a single journal transaction. A file can
+ * not be grown with this function.
+ * @param file - The file to truncate
+ * @param new_size - The new size of the file in bytes
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_ftruncate(llfs_file *file, int new_size);
+
+/**
+ * Open a directory to list its entries. Entries are read one directory block at a time so
+ * listing a directory uses the same memory no matter how many entries it has. The directory
+ * must be closed with llfs_closedir.
+ *
+ * The directory can also be given to llfs_openat, llfs_mkdirat, llfs_touchat and llfs_rmat as the
+ * starting point of relative paths, so files in it are found with a single directory lookup
+ * instead of walking the whole path from the root each time. It must not be removed while open.
+ * @param path - Absolute path to the directory
+ * @param dir - A pointer to store the directory in
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_opendir(char *path, llfs_dir **dir);
+
+/**
+ * Read the next entry of a directory. Entries are not returned in any particular order and
+ * END_OF_FILE_ERROR is returned once every entry has been read.
+ * @param dir - The directory to read from
+ * @param entry - Set to the next entry, its type and size are left unknown
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_readdir(llfs_dir *dir, llfs_dirent *entry);
+
+/**
+ * Read the next entry of a directory along with the type and size from its inode, which saves
+ * opening every entry to find out what it is.
+ * @param dir - The directory to read from
+ * @param entry - Set to the next entry
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_readdir_plus(llfs_dir *dir, llfs_dirent *entry);
+
+/**
+ * Closes and frees the memory associated with the directory provided.
+ * @param dir - The directory to close
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_closedir(llfs_dir *dir);
+
 /**
  * Remove a directory or file at the absolute path provided. If the recursive flag is set then
  * if the file is a directory, all of its children will be removed. If the recursive flag is not
@@ -96,4 +299,83 @@ llfs_error llfs_fwrite(char *content, int size, int count, llfs_file *file);
  */
 llfs_error llfs_rm(char *path, int recursive);
 
+/**
+ * Open a file like llfs_fopen. A relative path starts from the directory handle and an absolute
+ * path from the root.
+ * @param dir - The directory relative paths start from
+ * @param path - The path of the file to open
+ * @param file - A pointer to store the file data in.
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_openat(llfs_dir *dir, char *path, llfs_file **file);
+
+/**
+ * Make a new directory like llfs_mkdir. A relative path starts from the directory handle and an
+ * absolute path from the root.
+ * @param dir - The directory relative paths start from
+ * @param path - The path of the new directory
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_mkdirat(llfs_dir *dir, char *path);
+
+/**
+ * Create a new flat file like llfs_touch. A relative path starts from the directory handle and an
+ * absolute path from the root.
+ * @param dir - The directory relative paths start from
+ * @param path - The path of the new file
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_touchat(llfs_dir *dir, char *path);
+
+/**
+ * Remove a file or directory like llfs_rm. A relative path starts from the directory handle and an
+ * absolute path from the root.
+ * @param dir - The directory relative paths start from
+ * @param path - Path to the file to remove
+ * @param recursive - Flag. 0 = non-recursive and 1 = recursive
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_rmat(llfs_dir *dir, char *path, int recursive);
+
+/**
+ * Call fn with the path and inode of every file and directory below root. The tree is walked by
+ * inode, without resolving any paths, and separate branches are walked in parallel by nthreads
+ * worker threads. fn is called from the worker threads, possibly several at once, and entries
+ * come in no particular order. Nothing may change the file system during the walk, so fn must
+ * not call any of the other functions here.
+ * @param root - Absolute path to the directory to walk, which is not passed to fn itself
+ * @param fn - The function to call for each entry. Returning an error stops the walk
+ * @param arg - Passed to every call of fn
+ * @param nthreads - The number of worker threads, from 1 to LLFS_WALK_MAX_THREADS
+ * @return - llfs_error - An error, the error returned by fn or 0 for success
+ */
+llfs_error llfs_walk(char *root, llfs_walk_fn fn, void *arg, int nthreads);
+
+/**
+ * Commit the operations which are waiting in the journal and write every committed change which is
+ * still only in the journal to its final location on the disk. Committed changes are safe without
+ * this, a crash replays them from the journal.
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_fsync();
+
+/**
+ * Set how long operations wait in the journal to be committed together. A crash loses the
+ * operations which have not been committed yet, but never part of one.
+ * @param ms - Milliseconds, 0 commits every operation on its own
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_set_commit_interval(int ms);
+
+/**
+ * Choose how file data is journaled on this volume, the choice is kept on the disk. Metadata is
+ * always journaled. LLFS_JOURNAL_DATA, the default, logs data too so it is written twice.
+ * LLFS_JOURNAL_ORDERED writes data in place before the metadata pointing at it is committed, so
+ * a crash never leaves a file pointing at blocks which were not written. LLFS_JOURNAL_WRITEBACK
+ * writes data in place after the metadata, after a crash a file can hold stale data.
+ * @param mode - The journal mode
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_journal_mode(llfs_journal_opt mode);
+
 #endif
\ No newline at end of file
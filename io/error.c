@@ -22,7 +22,9 @@ static const char *LLFS_ERROR_STRING[] = {
         "The File Provided Has Not Been Allocated",
         "A File Already Exists With The Name Provided",
         "A Journal Error Has Occurred",
-        "The Journal Header Found Is Invalid"
+        "The Journal Header Found Is Invalid",
+        "The Block Is Shared By Too Many Files",
+        "The Operation Does Not Fit In One Journal Transaction"
 };
 
 const char *llfs_strerror(llfs_error e) {
@@ -27,7 +27,9 @@ typedef enum llfs_error {
     FILE_NOT_ALLOCATED_ERROR,
     FILE_ALREADY_EXISTS_ERROR,
     JOURNAL_ERROR,
-    JOURNAL_BAD_HEADER
+    JOURNAL_BAD_HEADER,
+    BLOCK_SHARE_LIMIT_ERROR,
+    TRANSACTION_TOO_LARGE_ERROR
 } llfs_error;
 
 const char *llfs_strerror(llfs_error e);
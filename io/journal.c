@@ -5,28 +5,225 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "error.h"
 #include "../disk/disk.h"
 #include "journal.h"
 
-#define jindex(val) ((val) % (JOURNAL_LENGTH - 1)) + JOURNAL_LOG_START
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HW 1
+#endif
+
+#define LOG_LENGTH (super.block_count - 1)
+#define jindex(val) (super.block_start + 1 + (val) % LOG_LENGTH)
+#define CRC32C_POLY 0x82F63B78u     // Castagnoli polynomial, bit reversed
+#define DELTA_LIMIT (BLOCK_SIZE / 2)  // Most bytes of delta records a block is logged as before it is logged whole
 
 typedef enum checksum_method {
-    CRC32
+    CRC32,      // Journals written before checksums were filled in, nothing to check
+    CRC32C
 } checksum_method;
 
+// A block of a committed transaction which has not been copied to its home location yet
+typedef struct journal_pending {
+    int32_t block_num;
+    char *data;
+    int dirty;          // Cleared once checkpointed, clean copies are kept as the base of delta records
+} journal_pending;
+
 // In memory copy of the journal super block
 journal_super super;
 
-llfs_error journal_create_checksum() {
-    // TODO: Create the journal checksum values
-    return 0;
+// The newest copy of every block committed since the last checkpoint. Reads look here first since
+// the copy on the disk is out of date until the block is checkpointed. The maps in front of the
+// journal stay here after they are checkpointed, since nearly every transaction changes a few
+// bytes of them and is logged as delta records against these copies.
+static journal_pending *pending = NULL;
+static int num_pending = 0;
+static int pending_capacity = 0;
+
+// Position in the log after the last committed transaction. The log from super.log_start up to
+// here holds the transactions which have not been checkpointed.
+static uint32_t log_end = 0;
+
+// Set when the journal is on the journal image instead of inside the disk, which must be the one
+// with the uuid the disk expects
+static int external = 0;
+static uint32_t external_uuid[4];
+
+// Sequence number of the next transaction. Every transaction in the log is numbered one more than
+// the one before it, so recovery can tell a transaction left over from an earlier pass around the
+// log from the next one.
+static uint32_t next_seq = 0;
+
+// The running transaction holds the blocks of operations which finished but are not committed
+// yet. Grouping operations means blocks they all change, such as the free block map, are logged
+// once for the whole group instead of once per operation.
+static file_block *running = NULL;
+static int num_running = 0;
+static struct timespec running_since;
+static int commit_interval = JOURNAL_COMMIT_INTERVAL;
+
+// Slicing by 8 tables, crc32c_table[k][b] is the crc of byte b followed by k zero bytes
+static uint32_t crc32c_table[8][256];
+static uint32_t (*crc32c_update)(uint32_t crc, const unsigned char *data, size_t len) = NULL;
+
+/**
+ * Update a crc 8 bytes at a time with the slicing by 8 tables
+ * @param crc - The crc so far, not inverted
+ * @param data - The data to add
+ * @param len - The number of bytes of data
+ * @return The updated crc
+ */
+uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t len) {
+    for (; len >= 8; data += 8, len -= 8) {
+        const uint32_t lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24);
+        const uint32_t hi = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t) data[7] << 24;
+        crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+              crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+              crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+    }
+
+    while (len-- > 0) crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
 }
 
-llfs_error journal_check_checksum() {
-    // TODO: Validate the journal checksum values
-    return 0;
+#ifdef CRC32C_HW
+/**
+ * Update a crc with the SSE4.2 crc32 instruction, which computes crc32c
+ * @param crc - The crc so far, not inverted
+ * @param data - The data to add
+ * @param len - The number of bytes of data
+ * @return The updated crc
+ */
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(uint64_t));
+        c = _mm_crc32_u64(c, word);
+    }
+
+    while (len-- > 0) c = _mm_crc32_u8((uint32_t) c, *data++);
+    return (uint32_t) c;
+}
+#endif
+
+/**
+ * Build the lookup tables and pick the fastest crc32c the processor supports
+ */
+void crc32c_init() {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[0][b] = crc;
+    }
+
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            const uint32_t prev = crc32c_table[k - 1][b];
+            crc32c_table[k][b] = crc32c_table[0][prev & 0xff] ^ (prev >> 8);
+        }
+    }
+
+    crc32c_update = crc32c_sw;
+#ifdef CRC32C_HW
+    if (__builtin_cpu_supports("sse4.2")) crc32c_update = crc32c_hw;
+#endif
+}
+
+/**
+ * Choose between the crc32 instruction and the slicing by 8 tables, so the two can be compared
+ * @param hw - Use the crc32 instruction when the processor supports it
+ * @return 1 if the crc32 instruction is used, 0 for the tables
+ */
+int journal_crc32c_select(int hw) {
+    crc32c_init();
+    if (!hw) crc32c_update = crc32c_sw;
+    return crc32c_update != crc32c_sw;
+}
+
+uint32_t journal_crc32c(uint32_t crc, const void *data, size_t len) {
+    if (crc32c_update == NULL) crc32c_init();
+    return ~crc32c_update(~crc, (const unsigned char *) data, len);
+}
+
+/**
+ * The number of log positions a transaction takes, counting its descriptors and commit block
+ * @param num_blocks - The number of data blocks in the transaction
+ * @return The size of the transaction in the log
+ */
+uint32_t journal_transaction_size(uint32_t num_blocks) {
+    return num_blocks + (num_blocks + JOURNAL_DESCRIPTOR_TAGS - 1) / JOURNAL_DESCRIPTOR_TAGS + 1;
+}
+
+/**
+ * The most data blocks a transaction can hold in a journal. One position of the log is always left
+ * empty so a full log can not be mistaken for an empty one.
+ * @param length - The number of blocks in the journal, including its super block
+ * @return The longest transaction in blocks
+ */
+uint32_t journal_fit(uint32_t length) {
+    uint32_t n = length - 1;
+    while (n > 0 && journal_transaction_size(n) + 1 > length - 1) n--;
+    return n;
+}
+
+int journal_max_transaction() {
+    return (int) super.max_transaction_len;
+}
+
+journal_mode journal_get_mode() {
+    return (journal_mode) super.mode;
+}
+
+/**
+ * Read a block of the journal itself, from the journal image when the journal is external
+ * @param block_num - The block to read
+ * @param block - Buffer to store the block data
+ * @return - disk_error or 0 for success
+ */
+disk_error journal_disk_read(int block_num, char *block) {
+    return external ? disk_journal_read_block(block_num, block) : disk_read_block(block_num, block);
+}
+
+/**
+ * Write a block of the journal itself, to the journal image when the journal is external
+ * @param block_num - The block to write
+ * @param block - The block data
+ * @return - disk_error or 0 for success
+ */
+disk_error journal_disk_write(int block_num, char *block) {
+    return external ? disk_journal_write_block(block_num, block) : disk_write_block(block_num, block);
+}
+
+/**
+ * Create a random version 4 uuid to link a disk with its external journal
+ * @param uuid - Set to the new uuid
+ */
+void journal_new_uuid(uint32_t uuid[4]) {
+    unsigned char *bytes = (unsigned char *) uuid;
+    FILE *source = fopen("/dev/urandom", "rb");
+    size_t read = source == NULL ? 0 : fread(bytes, 1, 16, source);
+    if (source != NULL) fclose(source);
+
+    if (read != 16) {
+        // Without a random device mix the time with the uuid's address instead
+        struct timespec now;
+        timespec_get(&now, TIME_UTC);
+        uuid[0] = (uint32_t) now.tv_sec;
+        uuid[1] = (uint32_t) now.tv_nsec;
+        uuid[2] = (uint32_t) (uintptr_t) uuid;
+        uuid[3] = journal_crc32c(0, uuid, sizeof(uint32_t) * 3);
+    }
+
+    bytes[6] = (bytes[6] & 0x0F) | 0x40;
+    bytes[8] = (bytes[8] & 0x3F) | 0x80;
 }
 
 /**
@@ -46,128 +243,668 @@ llfs_error write_blocks(file_block *blocks, int num_blocks) {
 }
 
 /**
- * Commit all of the journals blocks to the disk
+ * Write the in memory super block to the disk
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_write_super() {
+    char buffer[BLOCK_SIZE] = { 0 };
+    memcpy(buffer, &super, sizeof(journal_super));
+    return journal_disk_write(super.block_start, buffer) == 0 ? 0 : DISK_ERROR;
+}
+
+/**
+ * Find the newest committed copy of a block which has not been checkpointed
+ * @param block_num - The block to find
+ * @return The pending copy or NULL if the copy on the disk is up to date
+ */
+journal_pending *journal_pending_find(int block_num) {
+    for (int i = 0; i < num_pending; i++) {
+        if (pending[i].block_num == block_num) return &pending[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Keep a copy of each block of a committed transaction until it is checkpointed. A block which
+ * is already pending from an earlier transaction is replaced, so it is only written home once.
+ * @param blocks - The blocks of the transaction
+ * @param num_blocks - The number of blocks
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_pending_add(file_block *blocks, int num_blocks) {
+    for (int i = 0; i < num_blocks; i++) {
+        journal_pending *p = journal_pending_find(blocks[i].block_num);
+        if (p == NULL) {
+            if (num_pending == pending_capacity) {
+                const int capacity = pending_capacity == 0 ? journal_max_transaction() * 2 : pending_capacity * 2;
+                journal_pending *grown = (journal_pending *) realloc(pending, capacity * sizeof(journal_pending));
+                if (grown == NULL) return MEMORY_ALLOC_ERROR;
+                pending = grown;
+                pending_capacity = capacity;
+            }
+
+            char *data = (char *) malloc(BLOCK_SIZE);
+            if (data == NULL) return MEMORY_ALLOC_ERROR;
+            journal_pending copy = { blocks[i].block_num, data, 1 };
+            pending[num_pending++] = copy;
+            p = &pending[num_pending - 1];
+        }
+
+        memcpy(p->data, blocks[i].block_data, BLOCK_SIZE);
+        p->dirty = 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Drop every pending block without writing it
+ */
+void journal_pending_clear() {
+    for (int i = 0; i < num_pending; i++) free(pending[i].data);
+    free(pending);
+    pending = NULL;
+    num_pending = 0;
+    pending_capacity = 0;
+}
+
+int journal_pending_cmp(const void *a, const void *b) {
+    return ((const journal_pending *) a)->block_num - ((const journal_pending *) b)->block_num;
+}
+
+/**
+ * Copy every pending block to its home location and free the log. The blocks are written in
+ * block order so the writes sweep across the disk once.
+ * @param extra - Blocks of a committed transaction which could not be kept pending, may be NULL
+ * @param num_extra - The number of extra blocks
  * @return - llfs_error or 0 for success
  */
-llfs_error journal_transaction_commit() {
-    char *buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
-    if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+llfs_error journal_checkpoint_with(file_block *extra, int num_extra) {
+    qsort(pending, num_pending, sizeof(journal_pending), journal_pending_cmp);
+    for (int i = 0; i < num_pending; i++) {
+        if (!pending[i].dirty) continue;
+        if (disk_write_block(pending[i].block_num, pending[i].data) != 0) return DISK_ERROR;
+        pending[i].dirty = 0;
+    }
+    if (num_extra > 0) unwrap(write_blocks(extra, num_extra));
 
-    disk_error e = disk_read_block(jindex(super.log_start), buffer);
-    if (e != 0) { free(buffer); return DISK_ERROR; }
+    // Keep the maps in front of the journal, the rest are rarely logged as deltas
+    int kept = 0;
+    for (int i = 0; i < num_pending; i++) {
+        if (pending[i].block_num < JOURNAL_LOCATION) pending[kept++] = pending[i];
+        else free(pending[i].data);
+    }
+    num_pending = kept;
 
-    journal_descriptor jd;
-    memcpy(&jd, buffer, sizeof(journal_descriptor));
-    if (jd.block_type != JOURNAL_DESCRIPTOR) { free(buffer); return JOURNAL_ERROR; }
+    if (super.log_start == log_end) return 0;
+    super.log_start = log_end;
+    super.log_seq = next_seq;
+    return journal_write_super();
+}
 
-    e = disk_read_block(jindex(super.log_start + jd.num_blocks + 1), buffer);
-    if (e != 0) { free(buffer); return DISK_ERROR; }
+llfs_error journal_checkpoint() {
+    unwrap(journal_flush());
+    return journal_checkpoint_with(NULL, 0);
+}
 
-    journal_commit cm;
-    memcpy(&cm, buffer, sizeof(journal_commit));
-    if (cm.block_type != JOURNAL_COMMIT) { free(buffer); return JOURNAL_ERROR; }
+/**
+ * Encode the bytes of a block which differ from its previous copy as delta records. Runs of
+ * changed bytes closer together than a record header are joined into one record.
+ * @param block_num - The home block
+ * @param old - The previous copy of the block
+ * @param block - The new copy of the block
+ * @param out - Buffer of DELTA_LIMIT bytes for the records
+ * @return The size of the records, 0 if nothing changed or -1 if the block is smaller logged whole
+ */
+int journal_delta_encode(int32_t block_num, const char *old, const char *block, char *out) {
+    int size = 0;
+    for (int i = 0; i < BLOCK_SIZE;) {
+        if (old[i] == block[i]) { i++; continue; }
+
+        int end = i + 1;
+        for (int j = end; j < BLOCK_SIZE && j - end < (int) sizeof(journal_delta); j++) {
+            if (old[j] != block[j]) end = j + 1;
+        }
+
+        if (size + (int) sizeof(journal_delta) + end - i > DELTA_LIMIT) return -1;
+        journal_delta d = { block_num, i, end - i };
+        memcpy(out + size, &d, sizeof(journal_delta));
+        memcpy(out + size + sizeof(journal_delta), block + i, end - i);
+        size += sizeof(journal_delta) + end - i;
+        i = end;
+    }
+
+    return size;
+}
+
+/**
+ * Choose how each block of a transaction goes into the log. A block with a copy in memory from an
+ * earlier transaction is logged as the bytes which changed when that is smaller, packed with the
+ * changes of other blocks into delta blocks, and not at all if nothing changed.
+ * @param blocks - The blocks of the transaction
+ * @param num_blocks - The number of blocks
+ * @param log - Set to num_blocks entries, the blocks to write to the log
+ * @param deltas - Set to the buffer of the delta blocks in log, free with the entries
+ * @return The number of blocks to write to the log or -1 if out of memory
+ */
+int journal_delta_pack(file_block *blocks, int num_blocks, file_block **log, char **deltas) {
+    *log = (file_block *) malloc(num_blocks * sizeof(file_block));
+    *deltas = (char *) calloc(num_blocks, BLOCK_SIZE);
+    if (*log == NULL || *deltas == NULL) { free(*log); free(*deltas); return -1; }
+
+    char records[DELTA_LIMIT];
+    int num_log = 0, num_deltas = 0, fill = BLOCK_SIZE;
+    for (int i = 0; i < num_blocks; i++) {
+        journal_pending *p = journal_pending_find(blocks[i].block_num);
+        const int size = p == NULL ? -1 : journal_delta_encode(blocks[i].block_num, p->data, blocks[i].block_data, records);
+        if (size < 0) {
+            (*log)[num_log++] = blocks[i];
+            continue;
+        }
+
+        // Each record is no larger than half a block so a full delta block always holds more than
+        // half a block of them, which never takes more blocks than logging them whole
+        for (int off = 0; off < size;) {
+            journal_delta d;
+            memcpy(&d, records + off, sizeof(journal_delta));
+            const int len = sizeof(journal_delta) + d.length;
+            if (fill + len > BLOCK_SIZE) { num_deltas++; fill = 0; }
+
+            memcpy(*deltas + (num_deltas - 1) * BLOCK_SIZE + fill, records + off, len);
+            fill += len;
+            off += len;
+        }
+    }
 
-    file_block *blocks = (file_block *) calloc(jd.num_blocks, sizeof(file_block));
-    if (blocks == NULL) { free(buffer); return MEMORY_ALLOC_ERROR; }
+    for (int i = 0; i < num_deltas; i++) {
+        file_block delta = { (int32_t) JOURNAL_DELTA_TAG, *deltas + i * BLOCK_SIZE, FB_REF };
+        (*log)[num_log++] = delta;
+    }
 
-    int i;
-    for (i = 0; i < jd.num_blocks; i++) {
-        blocks[i].block_data = calloc(BLOCK_SIZE, sizeof(char));
-        if (blocks[i].block_data == NULL) break;
-        e = disk_read_block(jindex(super.log_start + i + 1), blocks[i].block_data);
-        if (e != 0) break;
+    return num_log;
+}
 
-        blocks[i].block_num = jd.blocks[i];
+/**
+ * Copy the delta records of a replayed delta block into the pending copies of their blocks,
+ * reading the copy at home for a block which is not pending yet
+ * @param delta - The delta block
+ * @return - llfs_error, JOURNAL_ERROR if a record does not fit in a block or 0 for success
+ */
+llfs_error journal_delta_apply(char *delta) {
+    for (int off = 0; off + (int) sizeof(journal_delta) <= BLOCK_SIZE;) {
+        journal_delta d;
+        memcpy(&d, delta + off, sizeof(journal_delta));
+        if (d.length == 0) break;
+        off += sizeof(journal_delta);
+        if (off + d.length > BLOCK_SIZE || d.offset + d.length > BLOCK_SIZE) return JOURNAL_ERROR;
+
+        journal_pending *p = journal_pending_find(d.block_num);
+        if (p == NULL) {
+            char block[BLOCK_SIZE];
+            if (disk_read_block(d.block_num, block) != 0) return DISK_ERROR;
+            file_block home = { d.block_num, block, FB_REF };
+            unwrap(journal_pending_add(&home, 1));
+            p = journal_pending_find(d.block_num);
+        }
+
+        memcpy(p->data + d.offset, delta + off, d.length);
+        p->dirty = 1;
+        off += d.length;
     }
 
-    llfs_error err = 0;
-    if (i == jd.num_blocks) err = write_blocks(blocks, jd.num_blocks);
+    return 0;
+}
+
+/**
+ * Write blocks to the log as one transaction, made up of descriptors listing where each block
+ * goes, the blocks and a commit block
+ * @param blocks - The blocks to log
+ * @param num_blocks - The number of blocks, which fit in the log
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_write_log(file_block *blocks, int num_blocks) {
+    // The transaction can not overwrite transactions which have not been checkpointed
+    const uint32_t used = (log_end + LOG_LENGTH - super.log_start) % LOG_LENGTH;
+    if (used + journal_transaction_size(num_blocks) + 1 > LOG_LENGTH) unwrap(journal_checkpoint_with(NULL, 0));
+
+    // Each descriptor lists the blocks written after it, a transaction with more blocks than one
+    // descriptor can list continues with another descriptor. The checksum covers every block.
+    char buffer[BLOCK_SIZE];
+    uint32_t pos = log_end, checksum = 0;
+    for (int i = 0; i < num_blocks; i += JOURNAL_DESCRIPTOR_TAGS) {
+        const int count = num_blocks - i < JOURNAL_DESCRIPTOR_TAGS ? num_blocks - i : JOURNAL_DESCRIPTOR_TAGS;
+        journal_descriptor desc = { JOURNAL_DESCRIPTOR, next_seq, count, { 0 } };
+        for (int j = 0; j < count; j++) desc.blocks[j] = blocks[i + j].block_num;
+
+        memset(buffer, 0, BLOCK_SIZE);
+        memcpy(buffer, &desc, sizeof(journal_descriptor));
+        if (journal_disk_write(jindex(pos), buffer) != 0) return DISK_ERROR;
+        checksum = journal_crc32c(checksum, buffer, BLOCK_SIZE);
+
+        for (int j = 0; j < count; j++) {
+            if (journal_disk_write(jindex(pos + j + 1), blocks[i + j].block_data) != 0) return DISK_ERROR;
+            checksum = journal_crc32c(checksum, blocks[i + j].block_data, BLOCK_SIZE);
+        }
+        pos += count + 1;
+    }
 
+    journal_commit cm = { JOURNAL_COMMIT, checksum, 0 };
     memset(buffer, 0, BLOCK_SIZE);
-    e = disk_write_block(jindex(super.log_start + jd.num_blocks + 2), buffer);
-    if (e != 0) err = DISK_ERROR;
+    memcpy(buffer, &cm, sizeof(journal_commit));
+    if (journal_disk_write(jindex(pos), buffer) != 0) return DISK_ERROR;
 
-    super.log_start = (super.log_start + jd.num_blocks + 2) % (JOURNAL_LENGTH - 1);
-    memcpy(buffer, &super, sizeof(journal_super));
-    e = disk_write_block(JOURNAL_LOCATION, buffer);
-    if (e != 0) err = DISK_ERROR;
+    log_end = (pos + 1) % LOG_LENGTH;
+    next_seq++;
+    return 0;
+}
 
-    for (int j = 0; j < i; ++j) free(blocks[j].block_data);
-    free(blocks);
-    free(buffer);
+/**
+ * Write a transaction to the log. The transaction is committed once its commit block is written,
+ * the blocks are logged whole or as delta records and are kept in memory. They are only copied
+ * to their home locations when the log needs the space or on journal_checkpoint.
+ * @param blocks - A list of file blocks to store
+ * @param num_blocks - The number of blocks in the first argument
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_write_transaction(file_block *blocks, int num_blocks) {
+    if (num_blocks > journal_max_transaction()) return JOURNAL_ERROR;
+    if (num_blocks <= 0) return 0;
 
-    return err;
+    file_block *log;
+    char *deltas;
+    const int num_log = journal_delta_pack(blocks, num_blocks, &log, &deltas);
+    if (num_log < 0) return MEMORY_ALLOC_ERROR;
+
+    llfs_error e = num_log == 0 ? 0 : journal_write_log(log, num_log);
+    free(log);
+    free(deltas);
+    if (e != 0) return e;
+
+    if (journal_pending_add(blocks, num_blocks) != 0) return journal_checkpoint_with(blocks, num_blocks);
+    return 0;
+}
+
+/**
+ * Find a block of the running transaction
+ * @param block_num - The block to find
+ * @return The block or NULL if it is not part of the running transaction
+ */
+file_block *journal_running_find(int block_num) {
+    for (int i = 0; i < num_running; i++) {
+        if (running[i].block_num == block_num) return &running[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Count the blocks of an operation which are not part of the running transaction yet
+ */
+int journal_running_missing(file_block *blocks, int num_blocks) {
+    int missing = 0;
+    for (int i = 0; i < num_blocks; i++) {
+        if (journal_running_find(blocks[i].block_num) == NULL) missing++;
+    }
+
+    return missing;
+}
+
+/**
+ * Drop the running transaction without committing it
+ */
+void journal_running_clear() {
+    for (int i = 0; i < num_running; i++) free(running[i].block_data);
+    num_running = 0;
+}
+
+/**
+ * Drop the running transaction and size it for the longest transaction of the journal
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_running_alloc() {
+    journal_running_clear();
+    file_block *r = (file_block *) realloc(running, super.max_transaction_len * sizeof(file_block));
+    if (r == NULL) return MEMORY_ALLOC_ERROR;
+
+    running = r;
+    return 0;
+}
+
+/**
+ * Milliseconds since the first operation joined the running transaction
+ */
+long journal_running_age() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (now.tv_sec - running_since.tv_sec) * 1000 + (now.tv_nsec - running_since.tv_nsec) / 1000000;
+}
+
+/**
+ * Commit the running transaction to the log
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_flush() {
+    if (num_running == 0) return 0;
+
+    llfs_error e = journal_write_transaction(running, num_running);
+    journal_running_clear();
+    return e;
 }
 
 /**
- * Create a new journal transaction and store all of the provided blocks in the journal
+ * Add the blocks of an operation to the running transaction. A block which is already part of it
+ * is replaced so it is only logged once. The running transaction is committed first if the
+ * operation does not fit, and after if it is full or older than the commit interval, so every
+ * operation is committed whole with the ones around it.
  * @param blocks - A list of file blocks to store
  * @param num_blocks - The number of blocks in the first argument
  * @return - llfs_error or 0 for success
  */
 llfs_error journal_new_transaction(file_block *blocks, int num_blocks) {
-    if (num_blocks > MAX_TRANSACTION_LEN) return JOURNAL_ERROR;
+    const int max = journal_max_transaction();
+    if (num_blocks > max) return TRANSACTION_TOO_LARGE_ERROR;
+    if (commit_interval == 0) {
+        unwrap(journal_flush());
+        return journal_write_transaction(blocks, num_blocks);
+    }
 
-    journal_descriptor desc = { JOURNAL_DESCRIPTOR, 0, num_blocks, { 0 } };
-    for (int i = 0; i < num_blocks; i++) desc.blocks[i] = blocks[i].block_num;
+    int added = journal_running_missing(blocks, num_blocks);
+    if (num_running + added > max) {
+        unwrap(journal_flush());
+        added = num_blocks;
+    }
 
-    char buffer[BLOCK_SIZE] = { 0 };
-    memcpy(buffer, &desc, sizeof(journal_descriptor));
+    // Everything is allocated up front so the operation either joins whole or not at all
+    for (int i = 0; i < added; i++) {
+        running[num_running + i].block_data = (char *) malloc(BLOCK_SIZE);
+        if (running[num_running + i].block_data != NULL) continue;
 
-    disk_error e = disk_write_block(jindex(super.log_start), buffer);
-    if (e != 0) return DISK_ERROR;
+        for (int j = 0; j < i; j++) free(running[num_running + j].block_data);
+        return MEMORY_ALLOC_ERROR;
+    }
 
-    for (int i = 0; i < num_blocks; i ++) {
-        e = disk_write_block(jindex(super.log_start + i + 1), blocks[i].block_data);
-        if (e != 0) return DISK_ERROR;
+    if (num_running == 0) timespec_get(&running_since, TIME_UTC);
+    for (int i = 0; i < num_blocks; i++) {
+        file_block *r = journal_running_find(blocks[i].block_num);
+        if (r == NULL) {
+            r = &running[num_running++];
+            r->block_num = blocks[i].block_num;
+            r->t = FB_OWNED;
+        }
+
+        memcpy(r->block_data, blocks[i].block_data, BLOCK_SIZE);
     }
 
-    journal_commit cm = { JOURNAL_COMMIT, 0, 0 };
-    memcpy(buffer, &cm, sizeof(journal_commit));
-    e = disk_write_block(jindex(super.log_start + num_blocks + 1), buffer);
-    if (e != 0) return DISK_ERROR;
+    if (num_running == max || journal_running_age() >= commit_interval) return journal_flush();
+    return 0;
+}
+
+void journal_set_commit_interval(int interval) {
+    commit_interval = interval < 0 ? 0 : interval;
+}
+
+/**
+ * Read a block, seeing the changes of committed transactions which were not checkpointed yet
+ * @param block_num - The block to read
+ * @param block - Buffer to store the block data
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_read_block(int block_num, char *block) {
+    file_block *r = journal_running_find(block_num);
+    if (r != NULL) {
+        memcpy(block, r->block_data, BLOCK_SIZE);
+        return 0;
+    }
+
+    journal_pending *p = journal_pending_find(block_num);
+    if (p != NULL) {
+        memcpy(block, p->data, BLOCK_SIZE);
+        return 0;
+    }
+
+    return disk_read_block(block_num, block) == 0 ? 0 : DISK_ERROR;
+}
+
+/**
+ * Read a block as it was last committed, without the changes of the running transaction
+ * @param block_num - The block to read
+ * @param block - Buffer to store the block data
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_read_committed(int block_num, char *block) {
+    journal_pending *p = journal_pending_find(block_num);
+    if (p != NULL) {
+        memcpy(block, p->data, BLOCK_SIZE);
+        return 0;
+    }
+
+    return disk_read_block(block_num, block) == 0 ? 0 : DISK_ERROR;
+}
+
+/**
+ * Read a run of consecutive blocks with a single read, seeing the changes of committed
+ * transactions which were not checkpointed yet
+ * @param block_num - The first block to read
+ * @param count - The number of blocks to read
+ * @param blocks - Buffer of count * BLOCK_SIZE bytes to store the block data
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_read_blocks(int block_num, int count, char *blocks) {
+    if (disk_read_blocks(block_num, count, blocks) != 0) return DISK_ERROR;
+
+    for (int i = 0; i < num_pending; i++) {
+        const int offset = pending[i].block_num - block_num;
+        if (offset >= 0 && offset < count) memcpy(blocks + offset * BLOCK_SIZE, pending[i].data, BLOCK_SIZE);
+    }
+    for (int i = 0; i < num_running; i++) {
+        const int offset = running[i].block_num - block_num;
+        if (offset >= 0 && offset < count) memcpy(blocks + offset * BLOCK_SIZE, running[i].block_data, BLOCK_SIZE);
+    }
+
+    return 0;
+}
+
+/**
+ * Replay the transaction at a position in the log into the pending blocks, which are written home
+ * once the whole log has been replayed
+ * @param pos - The position of the transactions first descriptor in the log
+ * @param seq - The sequence number the transaction must have
+ * @param next - Set to the position after the transaction
+ * @return - llfs_error, JOURNAL_ERROR if there is no complete transaction at pos or 0 for success
+ */
+llfs_error journal_replay(uint32_t pos, uint32_t seq, uint32_t *next) {
+    char header[BLOCK_SIZE];
+    file_block *blocks = NULL;
+    int num_blocks = 0;
+    uint32_t at = pos, checksum = 0;
 
-    llfs_error err = journal_transaction_commit();
+    // Read each descriptor and the blocks it lists until the commit block
+    llfs_error err = 0;
+    while (err == 0) {
+        if (journal_disk_read(jindex(at), header) != 0) { err = DISK_ERROR; break; }
+
+        journal_descriptor jd;
+        memcpy(&jd, header, sizeof(journal_descriptor));
+        if (jd.block_type == JOURNAL_COMMIT && num_blocks > 0) break;
+
+        // A transaction from an earlier pass around the log has an older sequence number, and none
+        // is longer than the log
+        if (jd.block_type != JOURNAL_DESCRIPTOR || jd.seq_num != seq || jd.num_blocks == 0
+            || jd.num_blocks > JOURNAL_DESCRIPTOR_TAGS || at - pos + jd.num_blocks + 2 > LOG_LENGTH - 1) {
+            err = JOURNAL_ERROR;
+            break;
+        }
+        checksum = journal_crc32c(checksum, header, BLOCK_SIZE);
+
+        file_block *grown = (file_block *) realloc(blocks, (num_blocks + jd.num_blocks) * sizeof(file_block));
+        if (grown == NULL) { err = MEMORY_ALLOC_ERROR; break; }
+        blocks = grown;
+
+        for (uint32_t i = 0; i < jd.num_blocks; i++) {
+            char *data = (char *) malloc(BLOCK_SIZE);
+            if (data == NULL) { err = MEMORY_ALLOC_ERROR; break; }
+            file_block b = { jd.blocks[i], data, FB_OWNED };
+            blocks[num_blocks++] = b;
+
+            if (journal_disk_read(jindex(at + i + 1), data) != 0) { err = DISK_ERROR; break; }
+            checksum = journal_crc32c(checksum, data, BLOCK_SIZE);
+        }
+        at += jd.num_blocks + 1;
+    }
+
+    // A transaction which was torn by a crash part way through writing it is never replayed
+    journal_commit cm;
+    memcpy(&cm, header, sizeof(journal_commit));
+    if (err == 0 && super.checksum_type == CRC32C && cm.checksum != checksum) err = JOURNAL_ERROR;
+    for (int i = 0; i < num_blocks && err == 0; i++) {
+        if ((uint32_t) blocks[i].block_num == JOURNAL_DELTA_TAG) err = journal_delta_apply(blocks[i].block_data);
+        else err = journal_pending_add(&blocks[i], 1);
+    }
+    if (err == 0) *next = (at + 1) % LOG_LENGTH;
+
+    for (int i = 0; i < num_blocks; i++) free(blocks[i].block_data);
+    free(blocks);
     return err;
 }
 
+/**
+ * Change how file data is written. The mode is kept in the journal super block so the volume is
+ * mounted with it again after a restart.
+ * @param mode - The new journal mode
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_set_mode(journal_mode mode) {
+    if (mode != JOURNAL_DATA && mode != JOURNAL_ORDERED && mode != JOURNAL_WRITEBACK) return INVALID_OPTION_ERROR;
+    if (super.mode == mode) return 0;
+
+    super.mode = mode;
+    return journal_write_super();
+}
+
+/**
+ * Write file data straight to its home location without logging it. A block with an older copy
+ * still in the journal is checkpointed first, otherwise the older copy could be written over
+ * the new data later or by recovery.
+ * @param blocks - The data blocks to write
+ * @param num_blocks - The number of blocks
+ * @return - llfs_error or 0 for success
+ */
+llfs_error journal_write_data(file_block *blocks, int num_blocks) {
+    for (int i = 0; i < num_blocks; i++) {
+        if (journal_running_find(blocks[i].block_num) == NULL && journal_pending_find(blocks[i].block_num) == NULL) continue;
+
+        unwrap(journal_checkpoint());
+        break;
+    }
+
+    return write_blocks(blocks, num_blocks);
+}
+
 /**
  * Initialize the journal with starting values to be called when the disk is
  * being formatted.
+ * @param length - The number of blocks in the journal, including its super block
+ * @param external - Put the journal at the start of the journal image instead of inside the disk
  * @return - llfs_error or 0 for success
  */
-llfs_error journal_init() {
+llfs_error journal_init(uint32_t length, int external_image) {
     char buffer[BLOCK_SIZE] = { 0 };
+    if (length < JOURNAL_LENGTH || length > JOURNAL_MAX_LENGTH) return INVALID_OPTION_ERROR;
+    external = external_image;
+    const uint32_t start = external ? 0 : JOURNAL_LOCATION;
+
+    // Number transactions past any an earlier format could have left in the log
+    journal_super old;
+    if (journal_disk_read(start, buffer) != 0) return DISK_ERROR;
+    memcpy(&old, buffer, sizeof(journal_super));
+    uint32_t seq = 1;
+    if (old.block_count >= JOURNAL_LENGTH && old.block_count <= JOURNAL_MAX_LENGTH) seq = old.log_seq + old.block_count;
 
-    journal_super s = { 0, JOURNAL_LOCATION, CRC32, JOURNAL_LENGTH, MAX_TRANSACTION_LEN, 0};
+    memset(buffer, 0, BLOCK_SIZE);
+    journal_super s = { 0, start, CRC32C, length, journal_fit(length), 0, JOURNAL_DATA, seq, { 0 } };
+    if (external) journal_new_uuid(s.uuid);
+    memcpy(external_uuid, s.uuid, sizeof(external_uuid));
     memcpy(buffer, &s, sizeof(journal_super));
-    disk_error e = disk_write_block(JOURNAL_LOCATION, buffer);
+    disk_error e = journal_disk_write(start, buffer);
     if (e != 0) return DISK_ERROR;
 
     llfs_error err = 0;
     memset(buffer, 0, BLOCK_SIZE);
-    e = disk_write_block(JOURNAL_LOG_START, buffer);
+    e = journal_disk_write(start + 1, buffer);
     if (e != 0) err = DISK_ERROR;
 
     super = s;
-    return err;
+    log_end = 0;
+    next_seq = seq;
+    journal_pending_clear();
+    llfs_error re = journal_running_alloc();
+    return err == 0 ? re : err;
+}
+
+/**
+ * Choose the journal journal_recover opens, to be called before mounting a disk
+ * @param uuid - The uuid of the disk's external journal, NULL or all zero for a journal inside the disk
+ */
+void journal_attach(const uint32_t *uuid) {
+    external = 0;
+    memset(external_uuid, 0, sizeof(external_uuid));
+    if (uuid == NULL) return;
+
+    for (int i = 0; i < 4; i++) {
+        if (uuid[i] != 0) external = 1;
+    }
+    memcpy(external_uuid, uuid, sizeof(external_uuid));
+}
+
+void journal_get_uuid(uint32_t uuid[4]) {
+    memcpy(uuid, super.uuid, sizeof(super.uuid));
 }
 
 /**
- * Recover the journal data from a crash. Simply replay the last
- * @return
+ * Recover the journal data from a crash. Every committed transaction from the start of the log
+ * is replayed in order, stopping at the first position which does not hold the complete
+ * transaction with the next sequence number. The newest copy of each replayed block is then
+ * written home once, in block order.
+ * @return - llfs_error or 0 for success
  */
 llfs_error journal_recover() {
     char buffer[BLOCK_SIZE] = { 0 };
 
-    disk_error e = disk_read_block(JOURNAL_LOCATION, buffer);
+    const uint32_t start = external ? 0 : JOURNAL_LOCATION;
+    disk_error e = journal_disk_read(start, buffer);
     if (e != 0) return DISK_ERROR;
 
+    // An external journal must be the one which was formatted with the disk
     memcpy(&super, buffer, sizeof(journal_super));
+    if (super.block_start != start || memcmp(super.uuid, external_uuid, sizeof(external_uuid)) != 0) return JOURNAL_ERROR;
+    if (super.block_count < JOURNAL_LENGTH || super.block_count > JOURNAL_MAX_LENGTH) return JOURNAL_ERROR;
+    if (super.max_transaction_len == 0 || super.max_transaction_len > journal_fit(super.block_count)) return JOURNAL_ERROR;
+    if (super.mode > JOURNAL_WRITEBACK) return JOURNAL_ERROR;
+    journal_pending_clear();
+    unwrap(journal_running_alloc());
 
-    llfs_error err = journal_transaction_commit();
-    // If error entry is incomplete and will be ignored or no entry is present
-    if (err == JOURNAL_ERROR) err = 0;
+    llfs_error err = 0;
+    uint32_t pos = super.log_start, replayed = 0;
+    next_seq = super.log_seq;
+    while (replayed < LOG_LENGTH) {
+        uint32_t next;
+        err = journal_replay(pos, next_seq, &next);
+        // If error entry is incomplete and will be ignored or no entry is present
+        if (err == JOURNAL_ERROR) { err = 0; break; }
+        if (err != 0) return err;
+
+        replayed += (next + LOG_LENGTH - pos) % LOG_LENGTH;
+        pos = next;
+        next_seq++;
+    }
 
-    return err;
-}
+    // Clear whatever is left at the end of the log so it is not mistaken for a transaction
+    memset(buffer, 0, BLOCK_SIZE);
+    e = journal_disk_write(jindex(pos), buffer);
+    if (e != 0) err = DISK_ERROR;
+
+    log_end = pos;
+    llfs_error ce = journal_checkpoint_with(NULL, 0);
+    return err == 0 ? ce : err;
+}
\ No newline at end of file
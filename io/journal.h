@@ -7,15 +7,26 @@
 #define JOURNAL_INCLUDED
 
 #include <stdint.h>
+#include <stddef.h>
 #include "error.h"
 
 #define JOURNAL_DESCRIPTOR 1
 #define JOURNAL_COMMIT 2
 
-#define MAX_TRANSACTION_LEN 10
 #define JOURNAL_LOCATION 12
 #define JOURNAL_LOG_START JOURNAL_LOCATION + 1
-#define JOURNAL_LENGTH 20
+#define JOURNAL_LENGTH 20               // Default number of blocks in the journal, including its super block
+#define JOURNAL_MAX_LENGTH 1024
+#define JOURNAL_DESCRIPTOR_TAGS 125     // Block locations which fit in a descriptor block
+#define JOURNAL_DELTA_TAG 0xFFFFFFFFu   // Descriptor tag of a block of journal_delta records
+#define JOURNAL_COMMIT_INTERVAL 1000    // Default milliseconds operations are grouped for
+
+// How file data is written, metadata is always journaled
+typedef enum journal_mode {
+    JOURNAL_DATA,       // Data is logged along with the metadata
+    JOURNAL_ORDERED,    // Data is written in place before the metadata linking it is committed
+    JOURNAL_WRITEBACK   // Data is written in place after the metadata, with no ordering
+} journal_mode;
 
 // Some blocks need to be referenced instead of owned so this is how we
 // can ensure they dont get referenced twice
@@ -33,10 +44,18 @@ typedef struct file_block {
 typedef struct journal_descriptor {
     uint32_t block_type;                  // Block type: Descriptor
     uint32_t seq_num;                     // Transaction sequence number
-    uint32_t num_blocks;                  // Number of blocks in the transaction
-    uint32_t blocks[MAX_TRANSACTION_LEN]; // Block location of each piece of data in transaction
+    uint32_t num_blocks;                      // Number of blocks following this descriptor
+    uint32_t blocks[JOURNAL_DESCRIPTOR_TAGS]; // Block location of each piece of data following this descriptor
 } journal_descriptor;
 
+// A run of bytes copied into a home block, a delta block holds these back to back each followed by
+// its bytes. A record with no bytes ends the block.
+typedef struct journal_delta {
+    uint32_t block_num;     // Home block the bytes are copied into
+    uint16_t offset;        // First byte of the run in the block
+    uint16_t length;        // Number of bytes in the run
+} journal_delta;
+
 typedef struct journal_commit {
     uint32_t block_type;     // Block type: Commit
     uint32_t checksum;       // Checksum for all of the data in transaction
@@ -50,10 +69,27 @@ typedef struct journal_super {
     uint32_t block_count;            // Number of blocks in journal
     uint32_t max_transaction_len;    // Max length of transaction
     uint32_t checksum;               // Checksum value of journal super block
+    uint32_t mode;                   // The journal_mode the volume is mounted with
+    uint32_t log_seq;                // Sequence number of the transaction at log_start
+    uint32_t uuid[4];                // Links an external journal to its disk, all zero inside the disk
 } journal_super;
 
 llfs_error journal_new_transaction(file_block *blocks, int num_blocks);
-llfs_error journal_init();
+uint32_t journal_crc32c(uint32_t crc, const void *data, size_t len);
+int journal_crc32c_select(int hw);
+llfs_error journal_init(uint32_t length, int external);
+void journal_attach(const uint32_t *uuid);
+void journal_get_uuid(uint32_t uuid[4]);
 llfs_error journal_recover();
+llfs_error journal_checkpoint();
+llfs_error journal_flush();
+int journal_max_transaction();
+journal_mode journal_get_mode();
+llfs_error journal_set_mode(journal_mode mode);
+llfs_error journal_write_data(file_block *blocks, int num_blocks);
+void journal_set_commit_interval(int interval);
+llfs_error journal_read_block(int block_num, char *block);
+llfs_error journal_read_committed(int block_num, char *block);
+llfs_error journal_read_blocks(int block_num, int count, char *blocks);
 
 #endif
\ No newline at end of file
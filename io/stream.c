@@ -0,0 +1,135 @@
+//
+// Created by curt white on 2020-04-06.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "system.h"
+#include "File.h"
+#include "stream.h"
+#include "../disk/disk.h"
+
+struct llfs_stream {
+    llfs_file *file;
+    char *buffer;               // Appended data which has not been written yet
+    int buffered;               // Number of bytes in the buffer
+    int flush_size;             // Bytes to collect before writing whole blocks
+    int flush_interval;         // Milliseconds data can wait before being written, 0 is no limit
+    struct timespec oldest;     // When the oldest byte in the buffer was appended
+};
+
+long elapsed_ms(struct timespec since) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (now.tv_sec - since.tv_sec) * 1000 + (now.tv_nsec - since.tv_nsec) / 1000000;
+}
+
+/**
+ * Write the first num_bytes of the buffer to the end of the file
+ * @param s - The stream to write from
+ * @param num_bytes - The number of bytes to write
+ * @return llfs_error or 0 for success
+ */
+llfs_error stream_commit(llfs_stream *s, int num_bytes) {
+    const int max_write = llfs_max_write();
+    int written = 0;
+    while (written < num_bytes) {
+        int len = num_bytes - written;
+        if (len > max_write) len = max_write;
+
+        unwrap(llfs_write(s->buffer + written, sizeof(char), len, s->file));
+        written += len;
+    }
+
+    s->buffered -= num_bytes;
+    memmove(s->buffer, s->buffer + num_bytes, s->buffered);
+    if (s->buffered > 0) timespec_get(&s->oldest, TIME_UTC);
+
+    return 0;
+}
+
+/**
+ * Write everything in the buffer which fills whole blocks at the end of the file. The
+ * remainder stays in the buffer until more data arrives.
+ * @param s - The stream to write from
+ * @return llfs_error or 0 for success
+ */
+llfs_error stream_commit_blocks(llfs_stream *s) {
+    const int size = s->file->inode.file_size;
+    const int end = ((size + s->buffered) / BLOCK_SIZE) * BLOCK_SIZE;
+    if (end <= size) return 0;
+
+    return stream_commit(s, end - size);
+}
+
+llfs_error llfs_stream_open(char *path, int flush_size, int flush_interval, llfs_stream **stream) {
+    if (flush_size < 0 || flush_interval < 0) return INVALID_OPTION_ERROR;
+    if (flush_size == 0) flush_size = llfs_max_write();
+
+    llfs_stream *s = (llfs_stream *) calloc(1, sizeof(llfs_stream));
+    if (s == NULL) return MEMORY_ALLOC_ERROR;
+
+    // Room for a full flush plus the partial block which is held back
+    s->buffer = (char *) calloc(flush_size + BLOCK_SIZE, sizeof(char));
+    if (s->buffer == NULL) { free(s); return MEMORY_ALLOC_ERROR; }
+
+    llfs_error e = llfs_fopen(path, &s->file);
+    if (e == 0) e = llfs_fseek(s->file, LLFS_FSEEK_END, 0);
+    if (e != 0) {
+        llfs_fclose(s->file);
+        free(s->buffer);
+        free(s);
+        *stream = NULL;
+        return e;
+    }
+
+    s->flush_size = flush_size;
+    s->flush_interval = flush_interval;
+    *stream = s;
+    return 0;
+}
+
+llfs_error llfs_stream_write(llfs_stream *stream, char *content, int size) {
+    if (stream == NULL) return FILE_NOT_ALLOCATED_ERROR;
+
+    while (size > 0) {
+        int len = stream->flush_size + BLOCK_SIZE - stream->buffered;
+        if (len > size) len = size;
+
+        if (stream->buffered == 0) timespec_get(&stream->oldest, TIME_UTC);
+        memcpy(stream->buffer + stream->buffered, content, len);
+        stream->buffered += len;
+        content += len;
+        size -= len;
+
+        if (stream->buffered >= stream->flush_size) unwrap(stream_commit_blocks(stream));
+    }
+
+    return llfs_stream_poll(stream);
+}
+
+llfs_error llfs_stream_poll(llfs_stream *stream) {
+    if (stream == NULL) return FILE_NOT_ALLOCATED_ERROR;
+    if (stream->flush_interval == 0 || stream->buffered == 0) return 0;
+    if (elapsed_ms(stream->oldest) < stream->flush_interval) return 0;
+
+    return llfs_stream_flush(stream);
+}
+
+llfs_error llfs_stream_flush(llfs_stream *stream) {
+    if (stream == NULL) return FILE_NOT_ALLOCATED_ERROR;
+    return stream_commit(stream, stream->buffered);
+}
+
+llfs_error llfs_stream_close(llfs_stream *stream) {
+    if (stream == NULL) return 0;
+
+    llfs_error e = llfs_stream_flush(stream);
+    llfs_error err = llfs_fclose(stream->file);
+    free(stream->buffer);
+    free(stream);
+
+    return e != 0 ? e : err;
+}
@@ -0,0 +1,56 @@
+//
+// Created by curt white on 2020-04-06.
+//
+
+#ifndef STREAM_INCLUDED
+#define STREAM_INCLUDED
+
+#include "error.h"
+
+typedef struct llfs_stream llfs_stream;
+
+/**
+ * Open a buffered writer which appends to the end of an existing file. Appends are collected
+ * in memory and only whole blocks are written once flush_size bytes are waiting, so many small
+ * records share a single journal transaction. Everything waiting is written by llfs_stream_flush,
+ * llfs_stream_close or once the oldest waiting byte is older than flush_interval.
+ * @param path - Absolute path of the file to append to
+ * @param flush_size - Bytes to collect before writing, 0 for the default of llfs_max_write() bytes
+ * @param flush_interval - Longest time in milliseconds data can wait, 0 to disable the timer
+ * @param stream - A pointer to store the stream in. Must be closed with llfs_stream_close
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_stream_open(char *path, int flush_size, int flush_interval, llfs_stream **stream);
+
+/**
+ * Append data to the stream.
+ * @param stream - The stream to append to
+ * @param content - The data to append
+ * @param size - The number of bytes to append
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_stream_write(llfs_stream *stream, char *content, int size);
+
+/**
+ * Write the waiting data if the flush interval has passed. The timer is also checked on every
+ * append, this is for producers which may go quiet for a while.
+ * @param stream - The stream to check
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_stream_poll(llfs_stream *stream);
+
+/**
+ * Write all of the waiting data to the file, including a partial last block.
+ * @param stream - The stream to flush
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_stream_flush(llfs_stream *stream);
+
+/**
+ * Flush the stream then close the file and free the stream.
+ * @param stream - The stream to close
+ * @return - llfs_error - An error or 0 for success
+ */
+llfs_error llfs_stream_close(llfs_stream *stream);
+
+#endif
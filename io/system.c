@@ -17,19 +17,46 @@
 const uint32_t SUPER_BLOCK_LOC = 0;
 const uint32_t FREE_BLOCK_LOC = 1;
 const uint32_t INODE_MAP_LOC = 2;
-const uint32_t ROOT_DIR_LOC = 32;
+const uint32_t REF_COUNT_LOC = 4;
 
 // 64 per block @ 4 bytes per entry
 const int INODE_MAP_SIZE = 2;
-const int RESERVED_BLOCKS = 33;
+// One byte per block counting the references beyond the first
+const int REF_COUNT_SIZE = BLOCK_COUNT / BLOCK_SIZE;
 const int INIT_BUFFER_SIZE = 10;
 const int REFS_PER_INDIRECT = BLOCK_SIZE / 4;
+// Files up to this size keep their data in the inode block after the inode
+const int INLINE_DATA_SIZE = BLOCK_SIZE - sizeof(llfs_inode);
+// Read ahead window sizes in blocks
+const int RA_INIT_WINDOW = 4;
+const int RA_MAX_WINDOW = 32;
+// Directories which outgrow this many blocks are converted to a hashed index
+const int DIR_INDEX_BLOCKS = 2;
+const int DIR_COMPACT_BLOCKS = 4;     // Most blocks a compacted directory is rewritten into
 
 #define MAX_INODES 256
 #define MAX_FILE_SIZE 8459264
+#define DIR_ENTRIES (BLOCK_SIZE / DIR_REC_LEN(1))    // Most entries a directory block can hold
+#define DCACHE_SIZE 256
+#define ICACHE_SIZE 64
+#define DIR_INDEX_LEAVES ((BLOCK_SIZE - sizeof(uint32_t) * 2) / sizeof(dir_index_entry))
 
 static uint32_t inode_map[MAX_INODES];
 static unsigned char free_block_map[BLOCK_SIZE];
+static unsigned char block_refs[BLOCK_COUNT];
+static unsigned int refs_dirty = 0;     // Bit per reference count block changed since the last commit
+static dentry dcache[DCACHE_SIZE];
+static inode_ref icache[ICACHE_SIZE];
+static uint32_t icache_clock = 0;       // Increases on every inode cache access to find the least recently used
+static uint32_t root_dir_loc = JOURNAL_LOCATION + JOURNAL_LENGTH;    // Follows the journal, whose length is set by formatting
+
+// The in memory maps an operation changes before it commits, saved so a failed operation can be undone
+typedef struct map_state {
+    uint32_t inode_map[MAX_INODES];
+    unsigned char free_block_map[BLOCK_SIZE];
+    unsigned char block_refs[BLOCK_COUNT];
+    unsigned int refs_dirty;
+} map_state;
 
 typedef struct super_block {
     uint32_t magic_number;
@@ -37,8 +64,27 @@ typedef struct super_block {
     uint32_t root_dir_block;
     uint32_t max_inodes;
     uint32_t used_inodes; // Unused, can be found by searching the map
+    uint32_t journal_uuid[4]; // The external journal formatted with the disk, all zero when the journal is inside it
 } super_block;
 
+typedef struct dir_index_entry {
+    uint32_t hash;      // Lowest name hash stored in the leaf
+    uint32_t block;     // Position of the leaf block in the directory
+} dir_index_entry;
+
+// Block 0 of a hashed directory. Leaves are sorted by hash and each holds every name whose
+// hash falls between its own hash and the hash of the next leaf
+typedef struct dir_index {
+    uint32_t count;
+    uint32_t reserved;
+    dir_index_entry leaves[DIR_INDEX_LEAVES];
+} dir_index;
+
+typedef struct hashed_entry {
+    uint32_t hash;
+    dir_entry entry;
+} hashed_entry;
+
 void llfs_print_inode(llfs_inode inode) {
     printf("Printing Inode \n");
     printf("File Size: %i\n", inode.file_size);
@@ -91,12 +137,33 @@ void llfs_print_file(llfs_file *file) {
 }
 
 /**
- * Write a copy of the blocks data to the write buffer
+ * Find the entry for a block in the write buffer
+ * @param buffer - The buffer to search
+ * @param block_num - The block number to search for
+ * @return The entry or NULL if the block is not in the buffer
+ */
+file_block *write_buffer_find(llfs_write_buffer *buffer, int block_num) {
+    for (int i = 0; i < buffer->num_blocks; i++) {
+        if (buffer->blocks[i].block_num == block_num) return &buffer->blocks[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Write a copy of the blocks data to the write buffer, replacing any earlier copy of the block
  * @param buffer - The buffer to add the data to
  * @param block - A block of data to be copied to the write buffer
  * @return LLFS error message or 0 for success
  */
 llfs_error write_buffer_cpy(llfs_write_buffer *buffer, file_block block) {
+    // A later change to a block already in the buffer replaces the earlier copy
+    file_block *existing = write_buffer_find(buffer, block.block_num);
+    if (existing != NULL && existing->t == FB_OWNED) {
+        memcpy(existing->block_data, block.block_data, BLOCK_SIZE);
+        return 0;
+    }
+
     file_block block_copy;
     block_copy.block_num = block.block_num;
     block_copy.t = FB_OWNED;
@@ -147,6 +214,31 @@ llfs_error write_buffer_destroy(llfs_write_buffer *buffer) {
     }
 
     if ( buffer->blocks != NULL ) free(buffer->blocks);
+    free(buffer->names);
+    return 0;
+}
+
+/**
+ * Record a change to a directory entry for the dentry cache. The cache only sees it once the
+ * buffer commits, so an operation which fails before its commit leaves the cache as it was.
+ * @param w - A write buffer object
+ * @param parent - The inode block of the directory holding the name
+ * @param name - The name of the file
+ * @param inode_loc - The inode block of the file or 0 if the name was removed
+ * @return llfs_error or 0 for success
+ */
+llfs_error write_buffer_name(llfs_write_buffer *w, uint32_t parent, const char *name, uint32_t inode_loc) {
+    if (strlen(name) >= sizeof(w->names[0].name)) return 0;     // Too long to be cached anyway
+
+    if (w->num_names % INIT_BUFFER_SIZE == 0) {
+        dentry *grown = (dentry *) realloc(w->names, (w->num_names + INIT_BUFFER_SIZE) * sizeof(dentry));
+        if (grown == NULL) return MEMORY_ALLOC_ERROR;
+        w->names = grown;
+    }
+
+    dentry *d = &w->names[w->num_names++];
+    *d = (dentry) { parent, inode_loc, { 0 } };
+    strncpy(d->name, name, sizeof(d->name) - 1);
     return 0;
 }
 
@@ -220,6 +312,189 @@ llfs_error free_blocks(int block_num, unsigned char *block_map, int map_size) {
     return 0;
 }
 
+/**
+ * Add a reference to a data block which is now shared with another file
+ * @param block_num - The block being shared
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_ref_block(int block_num) {
+    if (block_num <= 0 || block_num >= BLOCK_COUNT) return BYTE_OUT_OF_RANGE_ERROR;
+    if (block_refs[block_num] == UINT8_MAX) return BLOCK_SHARE_LIMIT_ERROR;
+
+    block_refs[block_num]++;
+    refs_dirty |= 1u << (unsigned int) (block_num / BLOCK_SIZE);
+    return 0;
+}
+
+/**
+ * Drop a files reference to a data block. The block is only freed once no other file shares it.
+ * @param block_num - The block being released
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_release_block(int block_num) {
+    if (block_num <= 0 || block_num >= BLOCK_COUNT) return BYTE_OUT_OF_RANGE_ERROR;
+    if (block_refs[block_num] == 0) return free_blocks(block_num, free_block_map, BLOCK_SIZE);
+
+    block_refs[block_num]--;
+    refs_dirty |= 1u << (unsigned int) (block_num / BLOCK_SIZE);
+    return 0;
+}
+
+/**
+ * Write the reference count blocks changed since the last commit to the buffer
+ * @param w - A write buffer object
+ * @return llfs_error or 0 for success
+ */
+llfs_error write_buffer_refs(llfs_write_buffer *w) {
+    for (int i = 0; i < REF_COUNT_SIZE; i++) {
+        if ((refs_dirty & (1u << (unsigned int) i)) == 0) continue;
+        unwrap(write_buffer_any(w, block_refs + i * BLOCK_SIZE, BLOCK_SIZE, REF_COUNT_LOC + i));
+    }
+
+    refs_dirty = 0;
+    return 0;
+}
+
+/**
+ * Read an inode from its block on the disk
+ * @param inode_loc - Block number of inode
+ * @param inode - Load inode to this location
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_read_inode(uint32_t inode_loc, llfs_inode *inode) {
+    char *inode_buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
+    if (inode_buffer == NULL) return MEMORY_ALLOC_ERROR;
+
+    llfs_error e = journal_read_block(inode_loc, inode_buffer);
+    if (e != 0) {
+        free(inode_buffer);
+        return DISK_ERROR;
+    }
+
+    memcpy(inode, inode_buffer, sizeof(llfs_inode));
+    free(inode_buffer);
+    return 0;
+}
+
+/**
+ * Look up an inode in the inode cache
+ * @param inode_loc - The inode block
+ * @return The cached inode or NULL if it is not cached
+ */
+inode_ref *llfs_icache_find(uint32_t inode_loc) {
+    if (inode_loc == 0) return NULL;
+
+    for (int i = 0; i < ICACHE_SIZE; i++) {
+        if (icache[i].loc != inode_loc) continue;
+        icache[i].last_used = ++icache_clock;
+        return &icache[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Find an inode in the inode cache, reading it into the least recently used slot which no open
+ * file is using on a miss. When every slot is in use ref is set to NULL and the caller has to
+ * read the inode itself.
+ * @param inode_loc - The inode block
+ * @param ref - Set to the cached inode
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_icache_load(uint32_t inode_loc, inode_ref **ref) {
+    *ref = llfs_icache_find(inode_loc);
+    if (*ref != NULL || inode_loc == 0) return 0;
+
+    inode_ref *victim = NULL;
+    for (int i = 0; i < ICACHE_SIZE; i++) {
+        if (icache[i].refs != 0) continue;
+        if (victim == NULL || icache[i].last_used < victim->last_used) victim = &icache[i];
+    }
+    if (victim == NULL) return 0;
+
+    llfs_inode inode;
+    unwrap(llfs_read_inode(inode_loc, &inode));
+
+    *victim = (inode_ref) { inode_loc, 0, 0, ++icache_clock, inode };
+    *ref = victim;
+    return 0;
+}
+
+/**
+ * Drop an inode which is being freed from the inode cache. Files still using it keep their
+ * copy, but the block can no longer be found under its old location.
+ * @param inode_loc - The inode block being freed
+ */
+void llfs_icache_forget(uint32_t inode_loc) {
+    inode_ref *ref = llfs_icache_find(inode_loc);
+    if (ref != NULL) ref->loc = 0;
+}
+
+/**
+ * Update the cached copy of every inode rewritten by a committed write buffer
+ * @param w - The committed write buffer
+ */
+void llfs_icache_publish(llfs_write_buffer *w) {
+    for (int i = 0; i < w->num_blocks; i++) {
+        inode_ref *ref = llfs_icache_find(w->blocks[i].block_num);
+        if (ref == NULL) continue;
+
+        memcpy(&ref->inode, w->blocks[i].block_data, sizeof(llfs_inode));
+        ref->version++;
+    }
+}
+
+/**
+ * Apply the directory entry changes of a committed write buffer to the dentry cache
+ * @param w - The committed write buffer
+ */
+void llfs_dcache_publish(llfs_write_buffer *w) {
+    for (int i = 0; i < w->num_names; i++) llfs_dcache_set(w->names[i].parent, w->names[i].name, w->names[i].inode_loc);
+}
+
+/**
+ * Commit two write buffers together in one transaction, with first ahead of last in it. An
+ * operation is never split across transactions, so one which does not fit in the journal is
+ * refused without logging anything and a crash can never leave part of it on the disk.
+ * @param first - The blocks to commit first
+ * @param last - The blocks to commit after first
+ * @return llfs_error, TRANSACTION_TOO_LARGE_ERROR if the blocks do not fit in one transaction or 0 for success
+ */
+llfs_error llfs_commit_ordered(llfs_write_buffer *first, llfs_write_buffer *last) {
+    const int total = first->num_blocks + last->num_blocks;
+    if (total == 0) return 0;
+    if (total > journal_max_transaction()) return TRANSACTION_TOO_LARGE_ERROR;
+
+    file_block *blocks = (file_block *) malloc(total * sizeof(file_block));
+    if (blocks == NULL) return MEMORY_ALLOC_ERROR;
+    if (first->num_blocks > 0) memcpy(blocks, first->blocks, first->num_blocks * sizeof(file_block));
+    if (last->num_blocks > 0) memcpy(blocks + first->num_blocks, last->blocks, last->num_blocks * sizeof(file_block));
+    llfs_error e = journal_new_transaction(blocks, total);
+    free(blocks);
+    if (e != 0) return e;
+
+    llfs_icache_publish(first);
+    llfs_icache_publish(last);
+    llfs_dcache_publish(first);
+    llfs_dcache_publish(last);
+    return 0;
+}
+
+/**
+ * Commit a write buffer along with any reference counts it dropped. The counts follow the blocks
+ * which stopped using them in the same transaction, so the disk never holds one without the other.
+ * @param w - A write buffer object
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_commit(llfs_write_buffer *w) {
+    llfs_write_buffer refs = { NULL, 0 };
+    llfs_error e = write_buffer_refs(&refs);
+    if (e == 0) e = llfs_commit_ordered(w, &refs);
+
+    write_buffer_destroy(&refs);
+    return e;
+}
+
 /**
  * Free an inode from the inode map
  * @param inode_num - The number of the inode to free
@@ -266,15 +541,15 @@ llfs_error llfs_get_file(char *path, char *file, char *dir_path) {
             if (i == strlen(path) - 1) return BAD_PATH_ERROR;
             subdir_count ++;
             strncpy(dir_path, path, i);
-            dir_path[i + 1] = '\0';
+            dir_path[i] = '\0';
 
-            unsigned int len = strlen(path) - i;
-            strncpy(file, path + i + 1, len);
-            file[len + 1] = '\0';
+            // Both buffers only need to hold the path itself, copy the name with its terminator
+            unsigned int len = strlen(path) - i - 1;
+            strncpy(file, path + i + 1, len + 1);
         }
     }
 
-    if (strlen(file) > 31) return BAD_PATH_ERROR;
+    if (strlen(file) > LLFS_NAME_MAX) return BAD_PATH_ERROR;
     if (subdir_count == 1) {
         dir_path[0] = '/';
         dir_path[1] = '\0';
@@ -286,123 +561,89 @@ llfs_error llfs_get_file(char *path, char *file, char *dir_path) {
 }
 
 /**
- * Set the block at the position provided by p with the value of block
- * @param f - The file to set the block in
- * @param p - An indexing struct location where to set block
- * @param block - The block getting set
- * @return llfs_error or 0 for success
+ * Find the in memory slot which holds the block at position p
+ * @param f - The file to find the slot in
+ * @param p - An indexing struct location of the block
+ * @return A pointer to the slot or NULL if the position is invalid or not allocated
  */
-llfs_error llfs_set_block(llfs_file *f, block_pos p, file_block block) {
-    file_block *loc;
+file_block *llfs_block_slot(llfs_file *f, block_pos p) {
     switch (p.t) {
         case DIRECT:
-            loc = &f->direct[p.l1];
-            break;
+            return &f->direct[p.l1];
         case IND:
-            loc = &f->ind.blocks[p.l1];
-            break;
+            if (f->ind.blocks == NULL) return NULL;
+            return &f->ind.blocks[p.l1];
         case DIND:
-            loc = &f->dind.blocks[p.l1].blocks[p.l2];
-            break;
+            if (f->dind.blocks == NULL || f->dind.blocks[p.l1].blocks == NULL) return NULL;
+            return &f->dind.blocks[p.l1].blocks[p.l2];
         default:
-            return INVALID_OPTION_ERROR;
-    }
-
-    // If we replace the data make sure we free it first
-    if (loc->block_data != NULL) {
-        free(loc->block_data);
+            return NULL;
     }
-
-    *loc = block;
-    return 0;
 }
 
 /**
- * Open a single block of data at store it at the location of pointer
- * @param f - The file to open the data into
- * @param p - The block position to put the piece of data
- * @param block_num - A block number for where the data is being stored on disk
- * @param pointer - A pointer to the data to store
+ * Set the block at the position provided by p with the value of block
+ * @param f - The file to set the block in
+ * @param p - An indexing struct location where to set block
+ * @param block - The block getting set
  * @return llfs_error or 0 for success
  */
-llfs_error llfs_open_block(llfs_file *f, block_pos p, int block_num, char **pointer) {
-    char *block = (char *) calloc(BLOCK_SIZE, sizeof(char));
-    if (block == NULL) return MEMORY_ALLOC_ERROR;
-
-    disk_error e = disk_read_block(block_num, block);
-    if (e != 0) {
-        free(block);
-        return DISK_ERROR;
-    }
+llfs_error llfs_set_block(llfs_file *f, block_pos p, file_block block) {
+    file_block *loc = llfs_block_slot(f, p);
+    if (loc == NULL) return INVALID_OPTION_ERROR;
 
-    file_block fb = { block_num, block, FB_OWNED };
-    llfs_error err = llfs_set_block(f, p, fb);
-    if (err != 0) {
-        free(block);
-        return DISK_ERROR;
+    // If we replace the data make sure we free it first
+    if (loc->block_data != NULL) {
+        free(loc->block_data);
     }
 
-    *pointer = block;
+    *loc = block;
     return 0;
 }
 
 /**
- * Open a single indirect block
+ * Open a single indirect block. Only the block numbers are brought into memory, the data
+ * blocks are read on demand by llfs_load_block.
  * @param ind - An indirect struct to store the data in
  * @param ind_loc - The location of that indirect block on disk (block number)
- * @param all_blocks - A buffer of all of the blocks being allocated so they can be freed if fails to open
- * @param curr_block - The current block number from the start of the file being opened
  * @return llfs_error or 0 for success
  */
-llfs_error llfs_open_indirect(indirect *ind, int ind_loc, char **all_blocks, int *curr_block) {
-    uint32_t *indirect = (uint32_t *) calloc(BLOCK_SIZE, sizeof(char *));
+llfs_error llfs_open_indirect(indirect *ind, int ind_loc) {
+    uint32_t *indirect = (uint32_t *) calloc(BLOCK_SIZE, sizeof(char));
     if (indirect == NULL) return MEMORY_ALLOC_ERROR;
 
-    file_block *fbs = (file_block *) calloc(BLOCK_SIZE, sizeof(char *));
+    file_block *fbs = (file_block *) calloc(REFS_PER_INDIRECT, sizeof(file_block));
     if (fbs == NULL) {
         free(indirect);
         return MEMORY_ALLOC_ERROR;
     }
 
-    ind->blocks = fbs;
-    ind->content = indirect;
-    disk_error e = disk_read_block(ind_loc, (char *) indirect);
+    llfs_error e = journal_read_block(ind_loc, (char *) indirect);
     if (e != 0) { free(indirect); free(fbs); return DISK_ERROR; }
 
     for (int i = 0; i < REFS_PER_INDIRECT; i++) {
-        int block_num = indirect[i];
-        if (block_num == 0) return 0;
-
-        char *block = (char *) calloc(BLOCK_SIZE, sizeof(char *));
-        if (block == NULL) { free(indirect); free(fbs); return MEMORY_ALLOC_ERROR; }
-
-        disk_error err = disk_read_block(block_num, block);
-        if (err != 0) { free(indirect); free(fbs); return DISK_ERROR; }
-
-        all_blocks[*curr_block] = block;
+        if (indirect[i] == 0) break;
 
-        file_block fb = { block_num, block, FB_OWNED };
+        file_block fb = { indirect[i], NULL, FB_OWNED };
         fbs[i] = fb;
-
-        (*curr_block)++;
     }
 
+    ind->blocks = fbs;
+    ind->content = indirect;
     return 0;
 }
 
 /**
- * Free all double indirect blocks
+ * Open a double indirect block along with all of the indirect blocks it references
  * @param dind - A double indirect block struct
  * @param dind_loc - The block location of the double indirect block map
- * @param all_blocks - A buffer of all of the blocks being allocated so they can be freed if fails to open
- * @param curr_block - The current block number from the start of the file being opened
  * @return llfs_error or 0 for success
  */
-llfs_error llfs_open_dind(double_indirect *dind, int dind_loc, char **all_blocks, int *curr_block) {
-    uint32_t *double_indirect = (uint32_t *) calloc(BLOCK_SIZE, sizeof(char *));
+llfs_error llfs_open_dind(double_indirect *dind, int dind_loc) {
+    uint32_t *double_indirect = (uint32_t *) calloc(BLOCK_SIZE, sizeof(char));
     if (double_indirect == NULL) return MEMORY_ALLOC_ERROR;
 
-    indirect *indirects = (indirect *) calloc(BLOCK_SIZE, sizeof(char *));
+    indirect *indirects = (indirect *) calloc(REFS_PER_INDIRECT, sizeof(indirect));
     if (indirects == NULL) {
         free(double_indirect);
         return MEMORY_ALLOC_ERROR;
@@ -410,10 +651,12 @@ llfs_error llfs_open_dind(double_indirect *dind, int dind_loc, char **all_blocks
 
     dind->blocks = indirects;
     dind->content = double_indirect;
-    disk_error e = disk_read_block(dind_loc, (char *) double_indirect);
+    llfs_error e = journal_read_block(dind_loc, (char *) double_indirect);
     if (e != 0) {
         free(indirects);
         free(double_indirect);
+        dind->blocks = NULL;
+        dind->content = NULL;
         return DISK_ERROR;
     }
 
@@ -421,22 +664,184 @@ llfs_error llfs_open_dind(double_indirect *dind, int dind_loc, char **all_blocks
     llfs_error err = 0;
     while (i < REFS_PER_INDIRECT) {
         if (double_indirect[i] == 0) break;
-        err = llfs_open_indirect(&indirects[i], double_indirect[i], all_blocks, curr_block);
+        err = llfs_open_indirect(&indirects[i], double_indirect[i]);
         if (err != 0) break;
         i++;
     }
 
-    if (err != 0) {
-        free(indirects);
-        free(double_indirect);
-        return err;
+    return err;
+}
+
+/**
+ * Find the in memory slot for the block at index from the start of the file
+ * @param f - The file to find the slot in
+ * @param index - The index of the block from the start of the file
+ * @return A pointer to the slot or NULL if the block is not mapped
+ */
+file_block *llfs_index_slot(llfs_file *f, int index) {
+    block_pos p;
+    if (llfs_get_pos(index * BLOCK_SIZE, &p) != 0) return NULL;
+    return llfs_block_slot(f, p);
+}
+
+typedef struct block_load {
+    int block_num;
+    file_block *slot;
+} block_load;
+
+int block_load_cmp(const void *a, const void *b) {
+    return ((const block_load *) a)->block_num - ((const block_load *) b)->block_num;
+}
+
+/**
+ * Read count blocks starting at index into memory. Blocks which are already loaded are skipped.
+ * The remaining blocks are sorted by their location on disk so that each run of consecutive
+ * blocks is fetched with a single disk read.
+ * @param f - The file to load the blocks into
+ * @param index - The index of the first block from the start of the file
+ * @param count - The number of blocks to load
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_read_blocks(llfs_file *f, int index, int count) {
+    block_load *loads = (block_load *) calloc(count, sizeof(block_load));
+    if (loads == NULL) return MEMORY_ALLOC_ERROR;
+
+    int num_loads = 0;
+    for (int i = index; i < index + count; i++) {
+        file_block *slot = llfs_index_slot(f, i);
+        // Block 0 is never file data, inline data is loaded with the file
+        if (slot == NULL || slot->block_num == 0) break;
+        if (slot->block_data != NULL) continue;
+
+        block_load l = { slot->block_num, slot };
+        loads[num_loads++] = l;
+    }
+
+    qsort(loads, num_loads, sizeof(block_load), block_load_cmp);
+
+    char *run = (char *) calloc(num_loads, BLOCK_SIZE);
+    if (run == NULL && num_loads > 0) { free(loads); return MEMORY_ALLOC_ERROR; }
+
+    llfs_error e = 0;
+    int start = 0;
+    while (start < num_loads && e == 0) {
+        int len = 1;
+        while (start + len < num_loads && loads[start + len].block_num == loads[start].block_num + len) len++;
+
+        if (journal_read_blocks(loads[start].block_num, len, run) != 0) { e = DISK_ERROR; break; }
+
+        for (int i = start; i < start + len; i++) {
+            char *block = (char *) calloc(BLOCK_SIZE, sizeof(char));
+            if (block == NULL) { e = MEMORY_ALLOC_ERROR; break; }
+
+            memcpy(block, run + (i - start) * BLOCK_SIZE, BLOCK_SIZE);
+            loads[i].slot->block_data = block;
+        }
+
+        start += len;
+    }
+
+    free(run);
+    free(loads);
+    return e;
+}
+
+/**
+ * Make sure the block at index is in memory. A miss which continues a sequential stream of reads
+ * also reads ahead a window of the following blocks, and the window doubles every time the stream
+ * continues up to RA_MAX_WINDOW. Random misses read just the block that was requested.
+ * @param f - The file to load the block into
+ * @param index - The index of the block from the start of the file
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_load_block(llfs_file *f, int index) {
+    file_block *slot = llfs_index_slot(f, index);
+    if (slot == NULL || slot->block_data != NULL || slot->block_num == 0) return 0;
+
+    int count = 1;
+    if (f->ra.advice == LLFS_ADV_SEQUENTIAL) {
+        f->ra.window = RA_MAX_WINDOW;
+        count = f->ra.window;
+    } else if (f->ra.advice == LLFS_ADV_NORMAL && index == f->ra.next) {
+        f->ra.window = f->ra.window == 0 ? RA_INIT_WINDOW : f->ra.window * 2;
+        if (f->ra.window > RA_MAX_WINDOW) f->ra.window = RA_MAX_WINDOW;
+        count = f->ra.window;
+    } else {
+        f->ra.window = 0;
+    }
+
+    f->ra.next = index + count;
+    return llfs_read_blocks(f, index, count);
+}
+
+/**
+ * Apply an access pattern hint to a file. SEQUENTIAL always reads ahead the largest window and
+ * RANDOM turns read ahead off. WILLNEED reads the blocks in the range now and DONTNEED releases
+ * them from memory, they will be read again if they are accessed.
+ * @param f - The file the hint applies to
+ * @param offset - The first byte of the range for WILLNEED and DONTNEED
+ * @param len - The length of the range in bytes, 0 means until the end of the file
+ * @param advice - The hint
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_advise(llfs_file *f, int offset, int len, llfs_advice advice) {
+    if (offset < 0 || len < 0) return BYTE_OUT_OF_RANGE_ERROR;
+
+    const int end = len == 0 || offset + len > f->inode.file_size ? f->inode.file_size : offset + len;
+    const int first = curr_block(offset);
+    const int last = (int) ceil((double) end / BLOCK_SIZE);
+
+    switch (advice) {
+        case LLFS_ADV_NORMAL:
+        case LLFS_ADV_SEQUENTIAL:
+        case LLFS_ADV_RANDOM:
+            f->ra.advice = advice;
+            f->ra.window = 0;
+            return 0;
+        case LLFS_ADV_WILLNEED:
+            if (last <= first) return 0;
+            return llfs_read_blocks(f, first, last - first);
+        case LLFS_ADV_DONTNEED:
+            for (int i = first; i < last; i++) {
+                file_block *slot = llfs_index_slot(f, i);
+                if (slot == NULL || slot->block_num == 0) break;
+                // Keep the block under the file pointer so it stays valid
+                if (i == curr_block(f->pointer_byte_loc)) continue;
+
+                free(slot->block_data);
+                slot->block_data = NULL;
+            }
+            return 0;
+        default:
+            return INVALID_OPTION_ERROR;
     }
+}
+
+/**
+ * Open the data of a file stored inline in its inode block. The data is kept in memory as the
+ * first direct block so that reads and writes do not need to know where it is stored. The block
+ * number is left as 0 since the data has no block of its own.
+ * @param file - The file to open the inline data into
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_open_inline(llfs_file *file) {
+    char *block = (char *) calloc(BLOCK_SIZE, sizeof(char));
+    if (block == NULL) return MEMORY_ALLOC_ERROR;
 
-    return  0;
+    llfs_error e = journal_read_block(file->inode_loc, block);
+    if (e != 0) { free(block); return DISK_ERROR; }
+
+    memmove(block, block + sizeof(llfs_inode), INLINE_DATA_SIZE);
+    memset(block + INLINE_DATA_SIZE, 0, sizeof(llfs_inode));
+
+    file_block fb = { 0, block, FB_OWNED };
+    file->direct[0] = fb;
+    return llfs_seek(file, LLFS_SEEK_START, 0);
 }
 
 /**
- * Retrieve all of the file contents from disk and bring it into memory
+ * Open a file from its inode. The block map of the file is brought into memory but the data blocks
+ * are only read when they are first accessed.
  * @param inode - The inode to open the file from
  * @param file - The file to open the data into
  * @param inode_loc - The location of the inode block on disk
@@ -446,47 +851,60 @@ llfs_error llfs_open_file(llfs_inode *inode, llfs_file *file, int inode_loc) {
     unsigned int total_blocks = ceil(((double) inode->file_size) / BLOCK_SIZE);
     if (inode->flags.type == DIR) { total_blocks = inode->flags.dir_blocks; }
 
-    char **all_blocks = (char **) calloc(total_blocks, sizeof(char *));
-    if (all_blocks == NULL) return MEMORY_ALLOC_ERROR;
-
     llfs_file new = { 0, 0, inode_loc, 0, *inode };
     memcpy(file, &new, sizeof(llfs_file));
+    if (inode_loc != 0) {
+        // Every open file of the inode shares one cached copy
+        unwrap(llfs_icache_load(inode_loc, &file->iref));
+        if (file->iref != NULL) {
+            file->iref->refs++;
+            file->iversion = file->iref->version;
+        }
+    }
     if (inode->file_size == 0 && total_blocks == 0) return EMPTY_FILE_ERROR;
+    if (inode->flags.inline_data) return llfs_open_inline(file);
+    // Hashed lookups go straight to one leaf so reading ahead would only waste reads
+    if (inode->flags.dir_index) file->ra.advice = LLFS_ADV_RANDOM;
 
-    int curr_block = 0;
-    block_pos p;
-    llfs_error e = 0;
-    while (curr_block < total_blocks) {
-        if (curr_block < 10) {
-            e = llfs_get_pos(file->pointer_byte_loc, &p);
-            if (e != 0) break;
-            e = llfs_open_block(file, p, inode->direct[curr_block], &all_blocks[curr_block]);
-            if (e != 0) break;
-            curr_block ++;
-            file->pointer_byte_loc += BLOCK_SIZE;
-        } else if (curr_block < REFS_PER_INDIRECT + 10) {
-            e = llfs_open_indirect(&file->ind, file->inode.indirect, all_blocks, &curr_block);
-            if (e != 0) break;
-        } else {
-            e = llfs_open_dind(&file->dind, file->inode.double_indirect, all_blocks, &curr_block);
-            if (e != 0) break;
-        }
+    for (int i = 0; i < 10 && i < total_blocks; i++) {
+        file_block fb = { inode->direct[i], NULL, FB_OWNED };
+        file->direct[i] = fb;
     }
 
-    // If opening any block fails all of the blocks that were opened are deallocated
-    if (e != 0) {
-        for (int i = 0; i < curr_block; ++i) {
-            free(all_blocks[i]);
-        }
+    llfs_error e = 0;
+    if (total_blocks > 10) e = llfs_open_indirect(&file->ind, inode->indirect);
+    if (e == 0 && total_blocks > REFS_PER_INDIRECT + 10) e = llfs_open_dind(&file->dind, inode->double_indirect);
 
-        return e;
-    }
+    if (e == 0) e = llfs_seek(file, LLFS_SEEK_START, 0);
+    if (e != 0) llfs_destroy_file(file);
 
-    free(all_blocks);
-    e = llfs_seek(file, LLFS_SEEK_START, 0);
     return e;
 }
 
+/**
+ * Reload the block map of a file if another file committed a change to its inode since it was
+ * loaded. The file pointer stays where it was unless the file has shrunk past it.
+ * @param f - The file to bring up to date
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_icache_sync(llfs_file *f) {
+    inode_ref *ref = f->iref;
+    if (ref == NULL || ref->loc != f->inode_loc || ref->version == f->iversion) return 0;
+
+    const int inode_loc = f->inode_loc;
+    const int pos = f->pointer_byte_loc;
+    const llfs_advice advice = f->ra.advice;
+    llfs_inode inode = ref->inode;
+
+    llfs_destroy_file(f);
+    llfs_error e = llfs_open_file(&inode, f, inode_loc);
+    if (e == EMPTY_FILE_ERROR) return 0;
+    if (e != 0) return e;
+
+    f->ra.advice = advice;
+    return llfs_seek(f, LLFS_SEEK_SET, pos < inode.file_size ? pos : (int) inode.file_size);
+}
+
 /**
  * Get the index of the requested byte in the file with index into the
  * @param byte - A number of the byte to move to
@@ -524,16 +942,14 @@ llfs_error llfs_get_pos(int byte, block_pos *p) {
  * @return llfs_error or 0 for success
  */
 llfs_error llfs_set(llfs_file *f, block_pos p) {
-    switch (p.t) {
-        case DIRECT:
-            f->loc_pointer = f->direct[p.l1].block_data + p.l2;
-            break;
-        case IND:
-            f->loc_pointer = f->ind.blocks[p.l1].block_data + p.l2;
-            break;
-        case DIND:
-            f->loc_pointer = f->dind.blocks[p.l1].blocks[p.l2].block_data + p.l3;
-            break;
+    unwrap(llfs_load_block(f, curr_block(p.byte)));
+
+    // The block after the end of a file may not be allocated yet
+    file_block *slot = llfs_block_slot(f, p);
+    if (slot == NULL || slot->block_data == NULL) {
+        f->loc_pointer = NULL;
+    } else {
+        f->loc_pointer = slot->block_data + (p.t == DIND ? p.l3 : p.l2);
     }
 
     f->pointer_byte_loc = p.byte;
@@ -552,20 +968,13 @@ llfs_error llfs_get_block(llfs_file *f, int byte, file_block *block) {
     llfs_error e = llfs_get_pos(byte, &p);
     if (e != 0) return e;
 
-    switch (p.t) {
-        case DIRECT:
-            *block = f->direct[p.l1];
-            break;
-        case IND:
-            *block = f->ind.blocks[p.l1];
-            break;
-        case DIND:
-            *block = f->dind.blocks[p.l1].blocks[p.l2];
-            break;
-        default:
-            return INVALID_OPTION_ERROR;
-    }
+    e = llfs_load_block(f, curr_block(byte));
+    if (e != 0) return e;
+
+    file_block *slot = llfs_block_slot(f, p);
+    if (slot == NULL) return INVALID_OPTION_ERROR;
 
+    *block = *slot;
     return 0;
 }
 
@@ -578,10 +987,11 @@ llfs_error llfs_get_block(llfs_file *f, int byte, file_block *block) {
  */
 llfs_error llfs_seek(llfs_file *f, llfs_seek_pos p, int offset) {
     block_pos pos;
+    unwrap(llfs_icache_sync(f));
 
     if (p == LLFS_SEEK_START) {
-        f->loc_pointer = f->direct[0].block_data;
-        f->pointer_byte_loc = 0;
+        unwrap(llfs_get_pos(0, &pos));
+        unwrap(llfs_set(f, pos));
     } else if (p == LLFS_SEEK_END) {
         unwrap(llfs_get_pos(f->inode.file_size, &pos));
         unwrap(llfs_set(f, pos));
@@ -597,6 +1007,7 @@ llfs_error llfs_seek(llfs_file *f, llfs_seek_pos p, int offset) {
 
 llfs_error llfs_get_bytes(llfs_file *f, char *buffer, int num_bytes, int opt) {
     int curr_byte = 0;
+    unwrap(llfs_icache_sync(f));
 
     for (int i = 0; i < num_bytes; i++) {
         if (f->pointer_byte_loc == f->inode.file_size && opt != 1) return END_OF_FILE_ERROR;
@@ -616,34 +1027,37 @@ llfs_error llfs_get_bytes(llfs_file *f, char *buffer, int num_bytes, int opt) {
 llfs_error llfs_free_file_blocks(llfs_file *f) {
     int freed = 0;
     int total_blocks = ceil((double) f->inode.file_size / BLOCK_SIZE);
+    if (f->inode.flags.inline_data) total_blocks = 0;
+    if (f->inode.flags.type == DIR) total_blocks = f->inode.flags.dir_blocks;
     if (f->inode_loc != 0) {
         free_blocks(f->inode_loc, free_block_map, BLOCK_SIZE);
+        llfs_icache_forget(f->inode_loc);
     }
 
     for (int i = 0; i < 10 && freed < total_blocks; i++, freed++) {
         if (f->inode.direct[i] == 0) printf("We have an error direct %i\n", freed);
-        free_blocks(f->inode.direct[i], free_block_map, BLOCK_SIZE);
+        llfs_release_block(f->inode.direct[i]);
     }
 
-    if (total_blocks >= 10) {
+    if (total_blocks > 10) {
         for (int i = 0; i < REFS_PER_INDIRECT; i++, freed++) {
             if (freed == total_blocks) break;
             int next = f->ind.content[freed - 10];
             if (next == 0) printf("We have an error indirect: %i\n", freed);
-            free_blocks(next, free_block_map, BLOCK_SIZE);
+            llfs_release_block(next);
         }
 
         if (f->inode.indirect == 0) printf("We have an error indirect: %i\n", freed);
         free_blocks(f->inode.indirect, free_block_map, BLOCK_SIZE);
     }
 
-    if (total_blocks >= REFS_PER_INDIRECT + 10) {
+    if (total_blocks > REFS_PER_INDIRECT + 10) {
         for (int j = 0; j < REFS_PER_INDIRECT; j++) {
             for (int i = 0; i < REFS_PER_INDIRECT; i++, freed++) {
                 if (freed == total_blocks) break;
                 int next = f->dind.blocks[j].content[i];
                 if (next == 0) printf("We have an error dind %i\n", freed);
-                free_blocks(next, free_block_map, BLOCK_SIZE);
+                llfs_release_block(next);
             }
 
             if (f->dind.content[j] == 0) printf("We have an error nested ind: %i\n", freed);
@@ -658,128 +1072,598 @@ llfs_error llfs_free_file_blocks(llfs_file *f) {
     return 0;
 }
 
-llfs_error llfs_dir_remove(llfs_write_buffer *w, llfs_file *f, char *file, int *inode_num) {
-    dir_entry *buffer = (dir_entry *) calloc(BLOCK_SIZE, sizeof(char));
-    if (buffer == NULL) return  MEMORY_ALLOC_ERROR;
+/**
+ * Hash a file name for the directory index using 32 bit FNV-1a
+ * @param name - The name to hash
+ * @return The hash of the name
+ */
+uint32_t llfs_name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
 
-    int seen = 0;
-    int block_num = 0;
-    llfs_error e = 0;
-    while (seen < f->inode.file_size) {
-        file_block fb;
-        llfs_get_block(f, f->pointer_byte_loc, &fb);
-        block_num = fb.block_num;
-
-        e = llfs_get_bytes(f, (char *) buffer, BLOCK_SIZE, 1);
-        if (e != 0 && e != END_OF_FILE_ERROR) return e;
-
-        for (int i = 0; i < BLOCK_SIZE / sizeof(dir_entry); i++) {
-            if (buffer[i].inode != 0) {
-                if (strcmp(file, buffer[i].name) == 0) {
-                    *inode_num = buffer[i].inode;
-                    buffer[i].inode = 0;
-                    f->inode.file_size -= sizeof(dir_entry);
-                    memcpy(fb.block_data, buffer, BLOCK_SIZE);
-                    goto break_loop;
-                }
+    return hash;
+}
 
-                seen += sizeof(dir_entry);
-                if (seen == f->inode.file_size) break;
-            }
+/**
+ * Find the slot of the dentry cache used by a name. The cache is direct mapped so a name
+ * replaces whatever entry was in its slot.
+ * @param parent - The inode block of the directory holding the name
+ * @param name - The name of the file
+ * @return The slot for the name
+ */
+dentry *llfs_dcache_slot(uint32_t parent, const char *name) {
+    return &dcache[(llfs_name_hash(name) ^ parent * 2654435761u) % DCACHE_SIZE];
+}
+
+/**
+ * Look up a name in the dentry cache
+ * @param parent - The inode block of the directory holding the name
+ * @param name - The name of the file
+ * @return The cached entry, which may be negative, or NULL if the name is not cached
+ */
+dentry *llfs_dcache_find(uint32_t parent, const char *name) {
+    dentry *d = llfs_dcache_slot(parent, name);
+    if (strlen(name) >= sizeof(d->name) || d->parent != parent || strcmp(d->name, name) != 0) return NULL;
+    return d;
+}
+
+/**
+ * Record where a name in a directory points, or that it does not exist
+ * @param parent - The inode block of the directory holding the name
+ * @param name - The name of the file
+ * @param inode_loc - The inode block of the file or 0 if it does not exist
+ */
+void llfs_dcache_set(uint32_t parent, const char *name, uint32_t inode_loc) {
+    dentry *d = llfs_dcache_slot(parent, name);
+    if (parent == 0 || strlen(name) >= sizeof(d->name)) return;
+
+    d->parent = parent;
+    d->inode_loc = inode_loc;
+    strncpy(d->name, name, sizeof(d->name));
+}
+
+/**
+ * Drop every cached name inside of or pointing to an inode which is being freed, so the
+ * block can be reused for another inode.
+ * @param inode_loc - The inode block being freed
+ */
+void llfs_dcache_forget(uint32_t inode_loc) {
+    for (int i = 0; i < DCACHE_SIZE; i++) {
+        if (dcache[i].parent == inode_loc || (dcache[i].parent != 0 && dcache[i].inode_loc == inode_loc)) {
+            memset(&dcache[i], 0, sizeof(dentry));
         }
     }
+}
 
-    break_loop:
-    e = write_buffer_any(w, buffer, BLOCK_SIZE, block_num);
-    free(buffer);
+int hashed_entry_cmp(const void *a, const void *b) {
+    const uint32_t ha = ((const hashed_entry *) a)->hash;
+    const uint32_t hb = ((const hashed_entry *) b)->hash;
+    return (ha > hb) - (ha < hb);
+}
+
+/**
+ * Find the leaf of a hashed directory which holds a name. Only the index block and the
+ * leaf are read no matter how large the directory is.
+ * @param f - The directory
+ * @param hash - The hash of the name
+ * @param leaf - Set to the leaf block
+ * @param slot - Set to the position of the leaf in the index, can be NULL
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_leaf(llfs_file *f, uint32_t hash, file_block *leaf, int *slot) {
+    file_block index_block;
+    unwrap(llfs_get_block(f, 0, &index_block));
+
+    dir_index *index = (dir_index *) index_block.block_data;
+    if (index == NULL || index->count == 0) return INVALID_OPTION_ERROR;
+
+    // The last leaf whose lowest hash is not above the hash being searched for
+    int lo = 0, hi = index->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (index->leaves[mid].hash <= hash) lo = mid;
+        else hi = mid - 1;
+    }
+
+    if (slot != NULL) *slot = lo;
+    unwrap(llfs_get_block(f, index->leaves[lo].block * BLOCK_SIZE, leaf));
+    return leaf->block_data == NULL ? INVALID_OPTION_ERROR : 0;
+}
+
+/**
+ * Get the length of a directory entry including the free space after it
+ * @param block - The directory block holding the entry
+ * @param r - The entry
+ * @return The length in bytes
+ */
+int llfs_record_len(char *block, dir_record *r) {
+    // Anything too short to be an entry is treated as reaching the end of the block
+    if (r->rec_len < sizeof(dir_record)) return BLOCK_SIZE - (int) ((char *) r - block);
+    return r->rec_len;
+}
+
+/**
+ * Get the entry after r in a directory block
+ * @param block - The directory block holding the entry
+ * @param r - The entry
+ * @return The next entry or NULL if r is the last one in the block
+ */
+dir_record *llfs_record_next(char *block, dir_record *r) {
+    char *next = (char *) r + llfs_record_len(block, r);
+    return next + sizeof(dir_record) <= block + BLOCK_SIZE ? (dir_record *) next : NULL;
+}
+
+/**
+ * Copy an entry out of a directory block
+ * @param r - The entry
+ * @return The entry with a terminated name
+ */
+dir_entry llfs_record_entry(dir_record *r) {
+    dir_entry entry = { r->inode };
+    memcpy(entry.name, (char *) (r + 1), r->name_len);
+    entry.name[r->name_len] = '\0';
+    return entry;
+}
+
+/**
+ * Find an entry in a single directory block
+ * @param block - The directory block
+ * @param name - The name to find
+ * @return The entry or NULL if there is no match
+ */
+dir_record *llfs_block_find(char *block, const char *name) {
+    const size_t len = strlen(name);
+    for (dir_record *r = (dir_record *) block; r != NULL; r = llfs_record_next(block, r)) {
+        if (r->inode != 0 && r->name_len == len && memcmp(r + 1, name, len) == 0) return r;
+    }
+
+    return NULL;
+}
+
+/**
+ * Add an entry to a directory block if there is room for it. The entry goes in the first gap
+ * large enough to hold it, splitting the free space off the end of the entry before it.
+ * @param block - The directory block
+ * @param entry - The entry to add
+ * @return 1 if the entry was added and 0 if the block is too full
+ */
+int llfs_block_add(char *block, dir_entry *entry) {
+    const int name_len = (int) strlen(entry->name);
+    const int needed = DIR_REC_LEN(name_len);
+
+    for (dir_record *r = (dir_record *) block; r != NULL; r = llfs_record_next(block, r)) {
+        const int used = r->inode != 0 ? DIR_REC_LEN(r->name_len) : 0;
+        const int len = llfs_record_len(block, r);
+        if (len - used < needed) continue;
+
+        dir_record *added = (dir_record *) ((char *) r + used);
+        if (used != 0) r->rec_len = used;
+        *added = (dir_record) { len - used, name_len, entry->inode };
+        memcpy(added + 1, entry->name, name_len);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Get the largest entry a directory block has room for
+ * @param block - The directory block
+ * @return The size in bytes of the largest gap between entries
+ */
+int llfs_block_room(char *block) {
+    int room = 0;
+    for (dir_record *r = (dir_record *) block; r != NULL; r = llfs_record_next(block, r)) {
+        const int gap = llfs_record_len(block, r) - (r->inode != 0 ? DIR_REC_LEN(r->name_len) : 0);
+        if (gap > room) room = gap;
+    }
+
+    return room;
+}
+
+/**
+ * Remove an entry from a directory block. Its space is given to the entry before it, or if it
+ * is the first entry of the block it is only marked unused.
+ * @param block - The directory block
+ * @param target - The entry to remove
+ */
+void llfs_block_remove(char *block, dir_record *target) {
+    dir_record *prev = NULL;
+    for (dir_record *r = (dir_record *) block; r != target; r = llfs_record_next(block, r)) prev = r;
+
+    if (prev == NULL) {
+        target->inode = 0;
+    } else {
+        prev->rec_len = llfs_record_len(block, prev) + llfs_record_len(block, target);
+    }
+}
+
+/**
+ * Find a name in a directory. A hashed directory only reads its index and one leaf, a linear
+ * one is searched block by block since removed entries can leave room in any of them.
+ * @param f - The directory
+ * @param name - The name to find
+ * @param fb - Set to the block holding the entry
+ * @param record - Set to the entry within the block
+ * @param index - Set to the position of the block in a linear directory, may be NULL
+ * @return llfs_error, FILE_NOT_FOUND_ERROR if there is no match or 0 for success
+ */
+llfs_error llfs_dir_find(llfs_file *f, const char *name, file_block *fb, dir_record **record, int *index) {
+    if (f->inode.flags.dir_index) {
+        unwrap(llfs_dir_leaf(f, llfs_name_hash(name), fb, NULL));
+        *record = llfs_block_find(fb->block_data, name);
+        return *record == NULL ? FILE_NOT_FOUND_ERROR : 0;
+    }
+
+    for (int i = 0; i < f->inode.flags.dir_blocks; i++) {
+        unwrap(llfs_get_block(f, i * BLOCK_SIZE, fb));
+        if (fb->block_data == NULL) return INVALID_OPTION_ERROR;
+
+        *record = llfs_block_find(fb->block_data, name);
+        if (index != NULL) *index = i;
+        if (*record != NULL) return 0;
+    }
+
+    return FILE_NOT_FOUND_ERROR;
+}
+
+/**
+ * Find where a leaf holding the sorted entries from start should end so that it uses close to
+ * target bytes. Names with the same hash have to share a leaf so they are never separated.
+ * @param sorted - Entries sorted by hash
+ * @param start - The first entry of the leaf
+ * @param count - The number of entries
+ * @param target - The number of bytes the leaf should use
+ * @return The index after the last entry of the leaf
+ */
+int llfs_leaf_end(hashed_entry *sorted, int start, int count, int target) {
+    int end = start, bytes = 0;
+    while (end < count) {
+        const int len = DIR_REC_LEN(strlen(sorted[end].entry.name));
+        if (end > start && bytes + len > target) break;
+        bytes += len;
+        end++;
+    }
+
+    while (end < count && end > start && sorted[end].hash == sorted[end - 1].hash) end++;
+    return end;
+}
+
+/**
+ * Replace the contents of a directory block with a list of entries
+ * @param block - The directory block
+ * @param entries - The entries to write
+ * @param count - The number of entries
+ * @return 1 if every entry fit and 0 otherwise
+ */
+int llfs_block_pack(char *block, hashed_entry *entries, int count) {
+    memset(block, 0, BLOCK_SIZE);
+    for (int i = 0; i < count; i++) {
+        if (!llfs_block_add(block, &entries[i].entry)) return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Release the blocks of a directory from keep onward, along with any indirect blocks which are
+ * no longer needed. The directory has to keep fewer than 10 blocks.
+ * @param f - The directory
+ * @param keep - The number of blocks to keep
+ */
+void llfs_dir_release_blocks(llfs_file *f, int keep) {
+    const int total = f->inode.flags.dir_blocks;
+    for (int i = keep; i < total; i++) {
+        file_block *slot = llfs_index_slot(f, i);
+        if (slot == NULL) continue;
+
+        llfs_release_block(slot->block_num);
+        free(slot->block_data);
+        *slot = (file_block) { 0, NULL, FB_OWNED };
+        if (i < 10) f->inode.direct[i] = 0;
+    }
+
+    if (total > 10) {
+        free_blocks(f->inode.indirect, free_block_map, BLOCK_SIZE);
+        free(f->ind.content);
+        free(f->ind.blocks);
+        f->ind = (indirect) { NULL, NULL };
+        f->inode.indirect = 0;
+    }
+
+    if (total > REFS_PER_INDIRECT + 10) {
+        for (int j = 0; j < REFS_PER_INDIRECT && f->dind.content[j] != 0; j++) {
+            free_blocks(f->dind.content[j], free_block_map, BLOCK_SIZE);
+            free(f->dind.blocks[j].content);
+            free(f->dind.blocks[j].blocks);
+        }
+
+        free_blocks(f->inode.double_indirect, free_block_map, BLOCK_SIZE);
+        free(f->dind.content);
+        free(f->dind.blocks);
+        f->dind = (double_indirect) { NULL, NULL };
+        f->inode.double_indirect = 0;
+    }
+
+    f->inode.flags.dir_blocks = keep;
+}
+
+/**
+ * Repack the live entries of a directory into as few blocks as possible and release the rest.
+ * Entries which fit in one block become a linear directory, otherwise the leaves of a hashed
+ * directory are rebuilt about three quarters full. Nothing changes when the directory would
+ * need more than DIR_COMPACT_BLOCKS blocks, which keeps the rewrite in one transaction.
+ * @param w - write buffer to append events to
+ * @param f - The directory
+ * @param compacted - Set to 1 if the directory was repacked, every block it kept is then in w
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_compact(llfs_write_buffer *w, llfs_file *f, int *compacted) {
+    const int leaf_size = BLOCK_SIZE * 3 / 4;
+    const int bytes = f->inode.file_size;
+    const int leaves = bytes <= BLOCK_SIZE ? 1 : (bytes + leaf_size - 1) / leaf_size;
+    const int hashed = bytes > BLOCK_SIZE;
+    const int new_blocks = leaves + hashed;
+
+    *compacted = 0;
+    if (new_blocks > DIR_COMPACT_BLOCKS || new_blocks >= f->inode.flags.dir_blocks) return 0;
+
+    const int first = f->inode.flags.dir_index;
+    hashed_entry *sorted = (hashed_entry *) calloc((f->inode.flags.dir_blocks - first) * DIR_ENTRIES, sizeof(hashed_entry));
+    if (sorted == NULL) return MEMORY_ALLOC_ERROR;
+
+    int count = 0;
+    int ends[DIR_COMPACT_BLOCKS];
+    file_block fb;
+    llfs_error e = 0;
+    for (int i = first; i < f->inode.flags.dir_blocks; i++) {
+        e = llfs_get_block(f, i * BLOCK_SIZE, &fb);
+        if (e != 0) goto free_exit;
+
+        for (dir_record *r = (dir_record *) fb.block_data; r != NULL; r = llfs_record_next(fb.block_data, r)) {
+            if (r->inode == 0) continue;
+            dir_entry entry = llfs_record_entry(r);
+            sorted[count++] = (hashed_entry) { llfs_name_hash(entry.name), entry };
+        }
+    }
+
+    // Plan every leaf before changing anything so a layout which does not fit is left alone
+    int start = 0, left = bytes;
+    if (hashed) qsort(sorted, count, sizeof(hashed_entry), hashed_entry_cmp);
+    for (int i = 0; i < leaves; i++) {
+        ends[i] = i == leaves - 1 ? count : llfs_leaf_end(sorted, start, count, left / (leaves - i));
+
+        int used = 0;
+        for (int j = start; j < ends[i]; j++) used += DIR_REC_LEN(strlen(sorted[j].entry.name));
+        if (used > BLOCK_SIZE || (hashed && ends[i] == start)) goto free_exit;
+
+        left -= used;
+        start = ends[i];
+    }
+
+    dir_index index;
+    memset(&index, 0, sizeof(dir_index));
+    index.count = leaves;
+
+    start = 0;
+    for (int i = 0; i < leaves; i++) {
+        e = llfs_get_block(f, (i + hashed) * BLOCK_SIZE, &fb);
+        if (e != 0) goto free_exit;
+
+        llfs_block_pack(fb.block_data, sorted + start, ends[i] - start);
+        index.leaves[i] = (dir_index_entry) { i == 0 ? 0 : sorted[start].hash, i + 1 };
+        start = ends[i];
+    }
+
+    if (hashed) {
+        e = llfs_get_block(f, 0, &fb);
+        if (e != 0) goto free_exit;
+        memset(fb.block_data, 0, BLOCK_SIZE);
+        memcpy(fb.block_data, &index, sizeof(dir_index));
+    }
+
+    llfs_dir_release_blocks(f, new_blocks);
+    f->inode.flags.dir_index = hashed;
+    f->inode.flags.dir_free = 0;
+    f->ra.advice = hashed ? LLFS_ADV_RANDOM : LLFS_ADV_NORMAL;
+
+    for (int i = 0; i < new_blocks; i++) {
+        e = llfs_get_block(f, i * BLOCK_SIZE, &fb);
+        if (e == 0) e = write_buffer_cpy(w, fb);
+        if (e != 0) goto free_exit;
+    }
+    *compacted = 1;
+
+    free_exit:
+    free(sorted);
     return e;
 }
 
+llfs_error llfs_dir_remove(llfs_write_buffer *w, llfs_file *f, char *file, int *inode_num) {
+    file_block fb;
+    dir_record *r;
+    int index = 0;
+    unwrap(llfs_dir_find(f, file, &fb, &r, &index));
+
+    *inode_num = r->inode;
+    f->inode.file_size -= DIR_REC_LEN(r->name_len);
+    llfs_block_remove(fb.block_data, r);
+    unwrap(write_buffer_name(w, f->inode_loc, file, 0));
+    if (!f->inode.flags.dir_index && index < f->inode.flags.dir_free) f->inode.flags.dir_free = index;
+
+    // Repack the directory once less than a quarter of its blocks is in use
+    int compacted = 0;
+    const int data_blocks = f->inode.flags.dir_blocks - f->inode.flags.dir_index;
+    if (data_blocks > 1 && f->inode.file_size * 4 < data_blocks * BLOCK_SIZE) {
+        unwrap(llfs_dir_compact(w, f, &compacted));
+    }
+
+    return compacted ? 0 : write_buffer_cpy(w, fb);
+}
+
+/**
+ * Save the in memory maps before an operation changes them
+ * @param s - Set to the current maps
+ */
+void llfs_maps_save(map_state *s) {
+    memcpy(s->inode_map, inode_map, sizeof(inode_map));
+    memcpy(s->free_block_map, free_block_map, sizeof(free_block_map));
+    memcpy(s->block_refs, block_refs, sizeof(block_refs));
+    s->refs_dirty = refs_dirty;
+}
+
+/**
+ * Put back the maps saved before a failed operation, releasing every block, inode and block
+ * reference it took so the next commit can not write them to the disk
+ * @param s - The maps saved before the operation
+ */
+void llfs_maps_restore(const map_state *s) {
+    memcpy(inode_map, s->inode_map, sizeof(inode_map));
+    memcpy(free_block_map, s->free_block_map, sizeof(free_block_map));
+    memcpy(block_refs, s->block_refs, sizeof(block_refs));
+    refs_dirty = s->refs_dirty;
+}
+
+/**
+ * Release the data blocks an indirect block references along with the indirect block itself
+ * @param loc - The block number of the indirect block
+ * @param count - The number of data blocks the indirect block references
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_release_indirect(int loc, int count) {
+    uint32_t content[BLOCK_SIZE / sizeof(uint32_t)];
+    if (journal_read_block(loc, (char *) content) != 0) return DISK_ERROR;
+
+    for (int i = 0; i < count; i++) unwrap(llfs_release_block(content[i]));
+    return free_blocks(loc, free_block_map, BLOCK_SIZE);
+}
+
+/**
+ * Release the inode block of a file and every block its block maps reference. Only the indirect
+ * blocks are read, so the file is not opened and none of its data is loaded.
+ * @param inode_loc - The inode block of the file
+ * @param node - The inode of the file
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_release_inode_blocks(int inode_loc, llfs_inode *node) {
+    const int pnum = REFS_PER_INDIRECT;
+    int total_blocks = ceil((double) node->file_size / BLOCK_SIZE);
+    if (node->flags.inline_data) total_blocks = 0;
+    if (node->flags.type == DIR) total_blocks = node->flags.dir_blocks;
+
+    unwrap(free_blocks(inode_loc, free_block_map, BLOCK_SIZE));
+    llfs_icache_forget(inode_loc);
+    for (int i = 0; i < 10 && i < total_blocks; i++) unwrap(llfs_release_block(node->direct[i]));
+
+    if (total_blocks > 10) {
+        unwrap(llfs_release_indirect(node->indirect, total_blocks - 10 < pnum ? total_blocks - 10 : pnum));
+    }
+
+    if (total_blocks > 10 + pnum) {
+        uint32_t content[BLOCK_SIZE / sizeof(uint32_t)];
+        if (journal_read_block(node->double_indirect, (char *) content) != 0) return DISK_ERROR;
+
+        int left = total_blocks - 10 - pnum;
+        for (int j = 0; left > 0; j++, left -= pnum) {
+            unwrap(llfs_release_indirect(content[j], left < pnum ? left : pnum));
+        }
+        unwrap(free_blocks(node->double_indirect, free_block_map, BLOCK_SIZE));
+    }
+
+    return 0;
+}
+
 /**
- * Free all of the blocks associated with a file and if using recursive the functions
- * will call itself on all sub directories and free all their blocks as well.
- * @param path - Path to the original file
+ * Free a file and, if it is a directory, everything below it. The tree is walked by inode with
+ * an explicit stack rather than by path, so each directory is read once however deep it is and
+ * the work is linear in the size of the tree. Only the in memory maps are changed, the caller
+ * commits them together in one transaction or puts them back if anything fails.
+ * @param inode_loc - The inode block of the file to free
  * @param recursive - 0 for non recursive, 1 for recursive
- * @param inode_num - Number of the inode so it can be freed from map
- * @return
+ * @return llfs_error or 0 for success
  */
-llfs_error llfs_free_files(char *path, int recursive, int inode_num) {
-    int inode_loc;
-    llfs_inode inode;
-    llfs_file file;
-    llfs_error e = llfs_get_inode(path, &inode, &inode_loc);
-    if (e != 0) return e;
+llfs_error llfs_free_tree(int inode_loc, int recursive) {
+    int size = 0, capacity = 16;
+    int *stack = (int *) malloc(capacity * sizeof(int));
+    if (stack == NULL) return MEMORY_ALLOC_ERROR;
+    stack[size++] = inode_loc;
+
+    llfs_error e = 0;
+    while (size > 0 && e == 0) {
+        const int loc = stack[--size];
+        llfs_inode inode;
+        e = llfs_open_inode(&inode, loc);
+        if (e != 0) break;
 
-    e = llfs_open_file(&inode, &file, inode_loc);
-    if (e != 0 && e != EMPTY_FILE_ERROR) { return e; }
-
-    if (inode.flags.type == DIR && inode.file_size > 0) {
-        if (!recursive) return NON_RECURSIVE_DELETE_ERROR;
-        dir_entry *buffer = (dir_entry *) calloc(BLOCK_SIZE, sizeof(char));
-        if (buffer == NULL) return  MEMORY_ALLOC_ERROR;
-        int seen = 0;
-
-        while (seen < inode.file_size) {
-            e = llfs_get_bytes(&file, (char *) buffer, BLOCK_SIZE, 1);
-            if (e != 0 && e != END_OF_FILE_ERROR) { free(buffer); return e; }
-
-            for (int i = 0; i < BLOCK_SIZE / sizeof(dir_entry); i++) {
-                if (buffer[i].inode != 0) {
-                    int new_path_len = strlen(path) + 33;
-                    char *new_path = (char *) calloc(new_path_len * sizeof(char), sizeof(char));
-                    if (new_path == NULL) { free(buffer); return MEMORY_ALLOC_ERROR;}
-                    strncpy(new_path, path, strlen(path) + 1);
-                    strncat(new_path, "/", 2);
-                    strncat(new_path, buffer[i].name, 31);
-
-                    e = llfs_free_files(new_path, 1, buffer[i].inode);
-                    free(new_path);
-                    if (e != 0) { free(buffer); return e;}
-                    seen += sizeof(dir_entry);
+        if (inode.flags.type == DIR && inode.file_size > 0) {
+            if (!recursive) { e = NON_RECURSIVE_DELETE_ERROR; break; }
+
+            llfs_dir dir;
+            dir_entry entry;
+            e = llfs_dir_open_inode(loc, &dir);
+            while (e == 0 && (e = llfs_dir_next(&dir, &entry, NULL)) == 0) {
+                if (size == capacity) {
+                    int *grown = (int *) realloc(stack, capacity * 2 * sizeof(int));
+                    if (grown == NULL) { e = MEMORY_ALLOC_ERROR; break; }
+                    stack = grown;
+                    capacity *= 2;
                 }
+
+                stack[size++] = inode_map[entry.inode - 1];
+                e = llfs_free_inode(entry.inode, inode_map, MAX_INODES);
             }
-        }
 
-        free(buffer);
-    }
+            llfs_dir_close(&dir);
+            if (e != END_OF_FILE_ERROR) break;
+        }
 
-    e = llfs_free_file_blocks(&file);
-    if (e != 0) return e;
-    if (inode_num != -1) {
-        llfs_free_inode(inode_num, inode_map, MAX_INODES);
+        e = llfs_release_inode_blocks(loc, &inode);
+        llfs_dcache_forget(loc);
     }
 
-    e = llfs_destroy_file(&file);
+    free(stack);
     return e;
 }
 
 llfs_error llfs_delete(char *path, int recursive) {
-    char *dir_path = calloc((strlen(path) + 1), sizeof(char));
-    char *file_name = calloc((strlen(path) + 1), sizeof(char));
-    llfs_write_buffer w = { NULL, 0 };
-
-    llfs_error e = llfs_get_file(path, file_name, dir_path);
-    if (e != 0) { free(dir_path); free(file_name); return e; }
+    return llfs_delete_at(root_dir_loc, path, recursive);
+}
 
-    int inode_loc;
-    llfs_inode dir_inode;
+/**
+ * Delete a file or directory. Relative paths are resolved starting from the directory at dir_loc.
+ * @param dir_loc - The inode block of the directory relative paths start from
+ * @param path - The path of the file to delete
+ * @param recursive - 0 for non recursive, 1 for recursive
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_delete_at(int dir_loc, char *path, int recursive) {
+    llfs_write_buffer w = { NULL, 0 };
     llfs_file file;
+    char *file_name;
 
-    e = llfs_get_inode(dir_path, &dir_inode, &inode_loc);
-    if (e != 0) { free(dir_path); free(file_name); return e; }
+    // The tree is freed in the maps as it is walked, so a failure part way has to undo it
+    map_state *saved = (map_state *) malloc(sizeof(map_state));
+    if (saved == NULL) return MEMORY_ALLOC_ERROR;
+    llfs_maps_save(saved);
 
-    e = llfs_open_file(&dir_inode, &file, inode_loc);
-    if (e != 0 && e != EMPTY_FILE_ERROR) { free(dir_path); free(file_name); return e; }
+    llfs_error e = llfs_open_parent(dir_loc, path, &file, &file_name);
+    if (e != 0) goto free_exit;
 
-    e = llfs_free_files(path, recursive, -1);
-    if (e != 0) { free(dir_path); free(file_name); return e; }
+    int inode_loc, inode_num = 0;
+    e = llfs_search_dir(&file, file_name, &inode_loc);
+    if (e != 0) goto free_exit;
+
+    e = llfs_free_tree(inode_loc, recursive);
+    if (e != 0) goto free_exit;
 
-    int inode_num = 0;
     e = llfs_dir_remove(&w, &file, file_name, &inode_num);
-    if (e != 0) { free(dir_path); free(file_name); return e; }
+    if (e != 0) goto free_exit;
 
     e = llfs_free_inode(inode_num, inode_map, MAX_INODES);
-    if (e != 0) { free(dir_path); free(file_name); return e; }
+    if (e != 0) goto free_exit;
 
     e = write_buffer_any(&w, &file.inode, sizeof(llfs_inode), file.inode_loc);
     if (e != 0) goto free_exit;
@@ -793,290 +1677,1602 @@ llfs_error llfs_delete(char *path, int recursive) {
     e = write_buffer_any(&w, inode_map + 128, sizeof(uint32_t) * 128, INODE_MAP_LOC + 1);
     if (e != 0) goto free_exit;
 
-    journal_new_transaction(w.blocks, w.num_blocks);
-    free_exit:
-    write_buffer_destroy(&w);
-    llfs_destroy_file(&file);
-    return e;
+    e = llfs_commit(&w);
+    free_exit:
+    if (e != 0) llfs_maps_restore(saved);
+    free(saved);
+    write_buffer_destroy(&w);
+    llfs_destroy_file(&file);
+    return e;
+}
+
+/**
+ * Give a file its own copy of a data block which it shares with other files. The data stays in
+ * memory and is only written under the new block number, the shared block loses a reference and
+ * whichever block map points at it is updated.
+ * @param f - The file about to modify the block
+ * @param w - A write buffer to add the updated block map to
+ * @param index - The index of the block within the file
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_unshare_block(llfs_file *f, llfs_write_buffer *w, int index) {
+    block_pos p;
+    unwrap(llfs_get_pos(index * BLOCK_SIZE, &p));
+
+    file_block *slot = llfs_block_slot(f, p);
+    if (slot == NULL || slot->block_num == 0 || block_refs[slot->block_num] == 0) return 0;
+    unwrap(llfs_load_block(f, index));
+
+    int block_num;
+    unwrap(llfs_reserve_blocks(&block_num, 1, free_block_map, BLOCK_SIZE));
+    unwrap(llfs_release_block(slot->block_num));
+    slot->block_num = block_num;
+
+    file_block map;
+    if (p.t == DIRECT) {
+        f->inode.direct[p.l1] = block_num;
+        return 0;
+    } else if (p.t == IND) {
+        f->ind.content[p.l1] = block_num;
+        map = (file_block) { f->inode.indirect, (char *) f->ind.content, FB_REF };
+    } else {
+        f->dind.blocks[p.l1].content[p.l2] = block_num;
+        map = (file_block) { f->dind.content[p.l1], (char *) f->dind.blocks[p.l1].content, FB_REF };
+    }
+
+    llfs_error e = write_buffer_append(w, map);
+    if (e != 0 && e != BUFFER_DUPLICATE_ERROR) return e;
+    return 0;
+}
+
+/**
+ * Write bytes at the file pointer, growing the file as needed
+ * @param w - A write buffer to add the metadata blocks to
+ * @param data - A write buffer to add the data blocks to, may be w
+ * @param f - The file to write to
+ * @param content - The bytes to write
+ * @param num_bytes - The number of bytes
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_write_bytes(llfs_write_buffer *w, llfs_write_buffer *data, llfs_file *f, const char *content, int num_bytes) {
+    int curr_block = curr_block(f->pointer_byte_loc);
+    int curr_byte = 0;
+
+    for (int i = 0; i < num_bytes; i++) {
+        if (f->inode.file_size == MAX_FILE_SIZE) return FILE_FULL_ERROR;
+        if (f->inode.flags.inline_data && f->inode.file_size == INLINE_DATA_SIZE
+            && f->pointer_byte_loc == f->inode.file_size) {
+            // Grown past the inline space so the data moves into a block of its own
+            int block_num;
+            unwrap(llfs_extend_file(f, w, 1, &block_num));
+            f->direct[0].block_num = block_num;
+            f->inode.flags.inline_data = 0;
+        }
+
+        if (f->inode.file_size == 0 && f->pointer_byte_loc == 0 && f->inode.flags.type == FLAT) {
+            // New data starts inline and only gets a block once it outgrows the inode block
+            char *buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
+            if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+
+            block_pos p = { DIRECT, 0, 0, 0, 0 };
+            file_block fb = { 0, buffer, FB_OWNED };
+            llfs_error e = llfs_set_block(f, p, fb);
+            if (e != 0) { free(buffer); return e; }
+            f->inode.flags.inline_data = 1;
+        } else if (f->inode.file_size % BLOCK_SIZE == 0 && f->pointer_byte_loc == f->inode.file_size) {
+            int block_num;
+            unwrap(llfs_extend_file(f, w, 1, &block_num));
+
+            char *buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
+            if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+
+            block_pos p;
+            file_block fb = { block_num, buffer, FB_OWNED };
+
+            llfs_error e = llfs_get_pos(f->inode.file_size, &p);
+            if (e != 0) { free(buffer); return e; }
+
+            e = llfs_set_block(f, p, fb);
+            if (e != 0) { free(buffer); return e; }
+        }
+        if ((i == 0 || f->pointer_byte_loc % BLOCK_SIZE == 0) && f->pointer_byte_loc < f->inode.file_size) {
+            // Shared blocks get a copy of their own before they are modified
+            unwrap(llfs_unshare_block(f, w, curr_block(f->pointer_byte_loc)));
+        }
+
+        if (f->pointer_byte_loc % BLOCK_SIZE == 0) {
+            unwrap(llfs_seek(f, LLFS_SEEK_SET, f->pointer_byte_loc));
+        }
+
+        if (f->pointer_byte_loc == f->inode.file_size) {
+            f->inode.file_size ++;
+        }
+
+        *f->loc_pointer = content[curr_byte];
+        curr_byte ++;
+        f->loc_pointer ++;
+        f->pointer_byte_loc ++;
+        int next_block = curr_block(f->pointer_byte_loc);
+        if (f->inode.flags.inline_data) {
+            // Inline data is written along with the inode
+        } else if (next_block != curr_block) {
+            file_block edited;
+            unwrap(llfs_get_block(f, f->pointer_byte_loc - 1, &edited));
+            unwrap(write_buffer_cpy(data, edited));
+        } else if (curr_byte >= num_bytes) {
+            file_block edited;
+            unwrap(llfs_get_block(f, f->pointer_byte_loc, &edited));
+            unwrap(write_buffer_cpy(data, edited));
+        }
+
+        curr_block = next_block;
+    }
+
+    return 0;
+}
+
+llfs_error llfs_write(char *content, int size, int count, llfs_file *file) {
+    llfs_iovec iov = { content, size * count };
+    return llfs_writev(&iov, 1, file);
+}
+
+/**
+ * Ordered data is written in place before its transaction commits. A block the write newly
+ * reserved which the committed free block map still shows as used was freed by an operation in
+ * the running transaction, so that transaction is committed first. Otherwise a crash would leave
+ * the new data in the file which still owns the block.
+ * @param before - The free block map from before the write reserved its blocks
+ * @param data - The data blocks about to be written in place
+ * @return llfs_error or 0 for success
+ */
+static llfs_error llfs_ordered_reuse(const unsigned char *before, llfs_write_buffer *data) {
+    unsigned char committed[BLOCK_SIZE];
+    int loaded = 0;
+
+    for (int i = 0; i < data->num_blocks; i++) {
+        const int b = data->blocks[i].block_num;
+        if (((before[b / 8] >> (unsigned int) (b % 8)) & 1u) == 0) continue;    // Already the file's block
+
+        if (!loaded) {
+            unwrap(journal_read_committed(FREE_BLOCK_LOC, (char *) committed));
+            loaded = 1;
+        }
+        if (((committed[b / 8] >> (unsigned int) (b % 8)) & 1u) == 0) return journal_flush();
+    }
+
+    return 0;
+}
+
+/**
+ * Write each buffer of the vector to the file one after another. All of the modified blocks
+ * are collected in one write buffer so the whole vector is committed in a single transaction.
+ * Unless the journal logs data, the data blocks are kept apart and written in place instead,
+ * before the transaction in ordered mode and after it in writeback mode.
+ * @param iov - The buffers to write
+ * @param count - The number of buffers
+ * @param file - The file to write to
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_writev(llfs_iovec *iov, int count, llfs_file *file) {
+    llfs_write_buffer w = { NULL, 0 };
+    llfs_write_buffer data = { NULL, 0 };
+    unsigned char before[BLOCK_SIZE];
+    const journal_mode mode = journal_get_mode();
+    llfs_error e = llfs_icache_sync(file);
+    if (e != 0) return e;
+    if (mode == JOURNAL_ORDERED) memcpy(before, free_block_map, BLOCK_SIZE);
+
+    for (int i = 0; i < count; i++) {
+        e = llfs_write_bytes(&w, mode == JOURNAL_DATA ? &w : &data, file, iov[i].base, iov[i].len);
+        if (e != 0) goto free_exit;
+    }
+
+    e = write_buffer_inode(&w, file);
+    if (e != 0) goto free_exit;
+
+    e = write_buffer_any(&w, (void *) free_block_map, BLOCK_SIZE, FREE_BLOCK_LOC);
+    if (e != 0) goto free_exit;
+
+    if (mode == JOURNAL_ORDERED) {
+        e = llfs_ordered_reuse(before, &data);
+        if (e != 0) goto free_exit;
+        e = journal_write_data(data.blocks, data.num_blocks);
+        if (e != 0) goto free_exit;
+    }
+
+    e = llfs_commit(&w);
+    if (e == 0 && mode == JOURNAL_WRITEBACK) e = journal_write_data(data.blocks, data.num_blocks);
+    if (e == 0 && file->iref != NULL) file->iversion = file->iref->version;
+
+    free_exit:
+    write_buffer_destroy(&w);
+    write_buffer_destroy(&data);
+    return e;
+}
+
+/**
+ * Read into each buffer of the vector one after another.
+ * @param iov - The buffers to fill
+ * @param count - The number of buffers
+ * @param file - The file to read from
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_readv(llfs_iovec *iov, int count, llfs_file *file) {
+    for (int i = 0; i < count; i++) {
+        unwrap(llfs_get_bytes(file, iov[i].base, iov[i].len, 0));
+    }
+
+    return 0;
+}
+
+/**
+ * Shrink a file to new_size bytes. Data blocks past the new end of the file and any indirect
+ * blocks which no longer reference data are only released in the free block map, so they never
+ * need to be written. The transaction holds the inode, the free block map, the last data block
+ * and whichever indirect blocks are still partially used, which keeps it well below
+ * the longest journal transaction no matter how many blocks the file releases.
+ * @param file - The file to truncate
+ * @param new_size - The new size of the file in bytes, can not be larger than the current size
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_truncate(llfs_file *file, int new_size) {
+    unwrap(llfs_icache_sync(file));
+    if (file->inode.flags.type != FLAT) return INVALID_OPTION_ERROR;
+    if (new_size < 0 || new_size > file->inode.file_size) return BYTE_OUT_OF_RANGE_ERROR;
+
+    const int pnum = REFS_PER_INDIRECT;
+    const int old_blocks = ceil((double) file->inode.file_size / BLOCK_SIZE);
+    const int new_blocks = ceil((double) new_size / BLOCK_SIZE);
+    llfs_write_buffer w = { NULL, 0 };
+    llfs_error e = 0;
+
+    for (int i = new_blocks; i < old_blocks; i++) {
+        block_pos p;
+        unwrap(llfs_get_pos(i * BLOCK_SIZE, &p));
+
+        file_block *slot = llfs_block_slot(file, p);
+        if (!file->inode.flags.inline_data) llfs_release_block(slot->block_num);
+        free(slot->block_data);
+        slot->block_data = NULL;
+        slot->block_num = 0;
+
+        if (p.t == DIRECT) file->inode.direct[p.l1] = 0;
+        else if (p.t == IND) file->ind.content[p.l1] = 0;
+        else file->dind.blocks[p.l1].content[p.l2] = 0;
+    }
+
+    if (old_blocks > 10 && new_blocks <= 10) { // Single indirect no longer used
+        free_blocks(file->inode.indirect, free_block_map, BLOCK_SIZE);
+        free(file->ind.content);
+        free(file->ind.blocks);
+        file->ind.content = NULL;
+        file->ind.blocks = NULL;
+        file->inode.indirect = 0;
+    } else if (old_blocks > 10 && new_blocks < pnum + 10) {
+        file_block f = { file->inode.indirect, (char *) file->ind.content, FB_REF };
+        e = write_buffer_append(&w, f);
+        if (e != 0) goto free_exit;
+    }
+
+    if (old_blocks > pnum + 10) {
+        const int old_inds = ceil((double) (old_blocks - 10 - pnum) / pnum);
+        const int new_inds = new_blocks > pnum + 10 ? ceil((double) (new_blocks - 10 - pnum) / pnum) : 0;
+
+        for (int j = new_inds; j < old_inds; j++) {
+            free_blocks(file->dind.content[j], free_block_map, BLOCK_SIZE);
+            free(file->dind.blocks[j].content);
+            free(file->dind.blocks[j].blocks);
+            file->dind.blocks[j].content = NULL;
+            file->dind.blocks[j].blocks = NULL;
+            file->dind.content[j] = 0;
+        }
+
+        if (new_inds == 0) { // Double indirect no longer used
+            free_blocks(file->inode.double_indirect, free_block_map, BLOCK_SIZE);
+            free(file->dind.content);
+            free(file->dind.blocks);
+            file->dind.content = NULL;
+            file->dind.blocks = NULL;
+            file->inode.double_indirect = 0;
+        } else {
+            file_block dind = { file->inode.double_indirect, (char *) file->dind.content, FB_REF };
+            e = write_buffer_append(&w, dind);
+            if (e != 0) goto free_exit;
+
+            if ((new_blocks - 10 - pnum) % pnum != 0) {
+                indirect *last = &file->dind.blocks[new_inds - 1];
+                file_block f = { file->dind.content[new_inds - 1], (char *) last->content, FB_REF };
+                e = write_buffer_append(&w, f);
+                if (e != 0) goto free_exit;
+            }
+        }
+    }
+
+    // Clear the tail of the last block so stale bytes do not reappear on disk
+    if (new_size % BLOCK_SIZE != 0) {
+        e = llfs_unshare_block(file, &w, curr_block(new_size));
+        if (e != 0) goto free_exit;
+
+        file_block last;
+        e = llfs_get_block(file, new_size, &last);
+        if (e != 0) goto free_exit;
+
+        memset(last.block_data + new_size % BLOCK_SIZE, 0, BLOCK_SIZE - new_size % BLOCK_SIZE);
+        if (!file->inode.flags.inline_data) e = write_buffer_cpy(&w, last);
+        if (e != 0) goto free_exit;
+    }
+
+    file->inode.file_size = new_size;
+    if (file->pointer_byte_loc > new_size) {
+        e = llfs_seek(file, LLFS_SEEK_END, 0);
+        if (e != 0) goto free_exit;
+    }
+
+    e = write_buffer_inode(&w, file);
+    if (e != 0) goto free_exit;
+
+    e = write_buffer_any(&w, (void *) free_block_map, BLOCK_SIZE, FREE_BLOCK_LOC);
+    if (e != 0) goto free_exit;
+
+    e = llfs_commit(&w);
+    if (e == 0 && file->iref != NULL) file->iversion = file->iref->version;
+
+    free_exit:
+    write_buffer_destroy(&w);
+    return e;
+}
+
+/**
+ * Add an empty block to the end of a directory. The block is not added to the write buffer
+ * since the caller still has to fill it.
+ * @param w - A write buffer to add any block map updates to
+ * @param f - The directory
+ * @param fb - Set to the new block
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_add_block(llfs_write_buffer *w, llfs_file *f, file_block *fb) {
+    int block_num = 0;
+    unwrap(llfs_extend_file(f, w, 1, &block_num));
+
+    char *block = (char *) calloc(BLOCK_SIZE, sizeof(char));
+    if (block == NULL) return MEMORY_ALLOC_ERROR;
+
+    block_pos p;
+    *fb = (file_block) { block_num, block, FB_OWNED };
+    llfs_error e = llfs_get_pos(f->inode.flags.dir_blocks * BLOCK_SIZE, &p);
+    if (e == 0) e = llfs_set_block(f, p, *fb);
+    if (e != 0) { free(block); return e; }
+
+    f->inode.flags.dir_blocks += 1;
+    return 0;
+}
+
+/**
+ * Convert a full linear directory to a hashed one while adding an entry. Two blocks are added,
+ * block 0 becomes the index and the entries are sorted by hash and spread over the others.
+ * @param w - write buffer to append events to
+ * @param f - The directory
+ * @param dir - The directory entry being added
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_build_index(llfs_write_buffer *w, llfs_file *f, dir_entry dir) {
+    const int old_blocks = f->inode.flags.dir_blocks;
+    hashed_entry *sorted = (hashed_entry *) calloc(old_blocks * DIR_ENTRIES + 1, sizeof(hashed_entry));
+    if (sorted == NULL) return MEMORY_ALLOC_ERROR;
+
+    int count = 0, bytes = 0;
+    file_block fb;
+    llfs_error e = 0;
+    for (int i = 0; i < old_blocks; i++) {
+        e = llfs_get_block(f, i * BLOCK_SIZE, &fb);
+        if (e != 0) goto free_exit;
+
+        for (dir_record *r = (dir_record *) fb.block_data; r != NULL; r = llfs_record_next(fb.block_data, r)) {
+            if (r->inode == 0) continue;
+            dir_entry entry = llfs_record_entry(r);
+            sorted[count++] = (hashed_entry) { llfs_name_hash(entry.name), entry };
+            bytes += DIR_REC_LEN(r->name_len);
+        }
+    }
+
+    sorted[count++] = (hashed_entry) { llfs_name_hash(dir.name), dir };
+    bytes += DIR_REC_LEN(strlen(dir.name));
+    qsort(sorted, count, sizeof(hashed_entry), hashed_entry_cmp);
+
+    for (int i = 0; i < 2; i++) {
+        e = llfs_dir_add_block(w, f, &fb);
+        if (e != 0) goto free_exit;
+    }
+
+    dir_index index;
+    memset(&index, 0, sizeof(dir_index));
+    index.count = f->inode.flags.dir_blocks - 1;
+
+    int start = 0;
+    for (int i = 0; i < index.count; i++) {
+        // Each leaf gets an even share of what is left
+        const int left = index.count - i;
+        int end = left == 1 ? count : llfs_leaf_end(sorted, start, count, bytes / left);
+        for (int j = start; j < end; j++) bytes -= DIR_REC_LEN(strlen(sorted[j].entry.name));
+
+        e = llfs_get_block(f, (i + 1) * BLOCK_SIZE, &fb);
+        if (e != 0) goto free_exit;
+
+        if (end == start || !llfs_block_pack(fb.block_data, sorted + start, end - start)) {
+            e = FILE_FULL_ERROR;
+            goto free_exit;
+        }
+
+        index.leaves[i] = (dir_index_entry) { i == 0 ? 0 : sorted[start].hash, i + 1 };
+        start = end;
+    }
+
+    e = llfs_get_block(f, 0, &fb);
+    if (e != 0) goto free_exit;
+    memcpy(fb.block_data, &index, sizeof(dir_index));
+
+    f->inode.flags.dir_index = 1;
+    f->inode.flags.dir_free = 0;
+    f->inode.file_size += DIR_REC_LEN(strlen(dir.name));
+    f->ra.advice = LLFS_ADV_RANDOM;
+
+    for (int i = 0; i < f->inode.flags.dir_blocks; i++) {
+        e = llfs_get_block(f, i * BLOCK_SIZE, &fb);
+        if (e == 0) e = write_buffer_cpy(w, fb);
+        if (e != 0) goto free_exit;
+    }
+
+    free_exit:
+    free(sorted);
+    return e;
+}
+
+/**
+ * Split a leaf of a hashed directory in two at a hash boundary, as close to the middle of its
+ * entries by size as possible. The new leaf is added to the index after the old one. A leaf
+ * whose entries all share one hash can not be split, so an empty leaf is added on the side of
+ * that hash the new name falls on instead.
+ * @param w - write buffer to append events to
+ * @param f - The directory
+ * @param leaf - The leaf to split
+ * @param slot - The position of the leaf in the index
+ * @param hash - The hash of the name which did not fit in the leaf
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_split_leaf(llfs_write_buffer *w, llfs_file *f, file_block leaf, int slot, uint32_t hash) {
+    file_block index_block, new_leaf;
+    unwrap(llfs_get_block(f, 0, &index_block));
+    dir_index *index = (dir_index *) index_block.block_data;
+    if (index->count == DIR_INDEX_LEAVES) return FILE_FULL_ERROR;
+
+    hashed_entry *sorted = (hashed_entry *) calloc(DIR_ENTRIES, sizeof(hashed_entry));
+    if (sorted == NULL) return MEMORY_ALLOC_ERROR;
+
+    int count = 0, bytes = 0;
+    for (dir_record *r = (dir_record *) leaf.block_data; r != NULL; r = llfs_record_next(leaf.block_data, r)) {
+        if (r->inode == 0) continue;
+        dir_entry entry = llfs_record_entry(r);
+        sorted[count++] = (hashed_entry) { llfs_name_hash(entry.name), entry };
+        bytes += DIR_REC_LEN(r->name_len);
+    }
+    qsort(sorted, count, sizeof(hashed_entry), hashed_entry_cmp);
+
+    // Fall back to the last hash boundary when the middle one is at the end
+    llfs_error e = 0;
+    int split = llfs_leaf_end(sorted, 0, count, bytes / 2);
+    if (split == count) {
+        for (split = count - 1; split > 0 && sorted[split].hash == sorted[split - 1].hash; split--);
+    }
+    if (split <= 0 && (count == 0 || sorted[0].hash == hash)) {
+        e = FILE_FULL_ERROR;
+        goto free_exit;
+    }
+
+    const int leaf_pos = f->inode.flags.dir_blocks;
+    e = llfs_dir_add_block(w, f, &new_leaf);
+    if (e != 0) goto free_exit;
+
+    memmove(&index->leaves[slot + 2], &index->leaves[slot + 1], (index->count - slot - 1) * sizeof(dir_index_entry));
+    index->count++;
+
+    if (split > 0) {
+        llfs_block_pack(leaf.block_data, sorted, split);
+        llfs_block_pack(new_leaf.block_data, sorted + split, count - split);
+        index->leaves[slot + 1] = (dir_index_entry) { sorted[split].hash, leaf_pos };
+    } else if (hash > sorted[0].hash) {
+        index->leaves[slot + 1] = (dir_index_entry) { hash, leaf_pos };
+    } else {
+        // The empty leaf takes over the hashes below the entries, which move up to their own hash
+        index->leaves[slot + 1] = (dir_index_entry) { sorted[0].hash, index->leaves[slot].block };
+        index->leaves[slot].block = leaf_pos;
+    }
+
+    e = write_buffer_cpy(w, index_block);
+    if (e == 0) e = write_buffer_cpy(w, leaf);
+    if (e == 0) e = write_buffer_cpy(w, new_leaf);
+
+    free_exit:
+    free(sorted);
+    return e;
+}
+
+/**
+ * Add an entry to a hashed directory. A full leaf is split in two and the new leaf is added to
+ * the index, so at most the index and two leaves are written.
+ * @param w - write buffer to append events to
+ * @param f - The directory
+ * @param dir - The directory entry to add
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_index_insert(llfs_write_buffer *w, llfs_file *f, dir_entry dir) {
+    const uint32_t hash = llfs_name_hash(dir.name);
+    file_block leaf;
+    int slot;
+    unwrap(llfs_dir_leaf(f, hash, &leaf, &slot));
+
+    // A long name may need a leaf to be split more than once before it fits
+    while (!llfs_block_add(leaf.block_data, &dir)) {
+        unwrap(llfs_dir_split_leaf(w, f, leaf, slot, hash));
+        unwrap(llfs_dir_leaf(f, hash, &leaf, &slot));
+    }
+
+    f->inode.file_size += DIR_REC_LEN(strlen(dir.name));
+    return write_buffer_cpy(w, leaf);
+}
+
+/**
+ * Add an entry to the first block of a linear directory with room for it or to its leaf in a
+ * hashed one
+ * @param w - write buffer to append events to
+ * @param f - The directory
+ * @param dir - The directory entry to add
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_insert(llfs_write_buffer *w, llfs_file *f, dir_entry dir) {
+    if (f->inode.flags.dir_index) return llfs_dir_index_insert(w, f, dir);
+
+    file_block fb = { 0, NULL, FB_OWNED };
+
+    // Entries can be removed from any block so look for room before adding a block, starting
+    // from the first block which is not full
+    for (int i = f->inode.flags.dir_free; i < f->inode.flags.dir_blocks; i++) {
+        unwrap(llfs_get_block(f, i * BLOCK_SIZE, &fb));
+        if (fb.block_data == NULL) return INVALID_OPTION_ERROR;
+
+        const int added = llfs_block_add(fb.block_data, &dir);
+        if (i == f->inode.flags.dir_free && llfs_block_room(fb.block_data) < DIR_REC_LEN(1)) {
+            f->inode.flags.dir_free = i + 1;
+        }
+        if (added) goto write_block;
+    }
+
+    if (f->inode.flags.type == DIR && f->inode.flags.dir_blocks >= DIR_INDEX_BLOCKS) {
+        return llfs_dir_build_index(w, f, dir);
+    }
+
+    unwrap(llfs_dir_add_block(w, f, &fb));
+    llfs_block_add(fb.block_data, &dir);
+
+    write_block:
+    f->inode.file_size += DIR_REC_LEN(strlen(dir.name));
+    return write_buffer_cpy(w, fb);
+}
+
+/**
+ * Append a file to the directory
+ * @param w - write buffer to append events to
+ * @param f - A file to write the data to
+ * @param dir - The directory entry to add to the file
+ * @return llfs_error
+ */
+llfs_error llfs_dir_append(llfs_write_buffer *w, llfs_file *f, dir_entry dir) {
+    unwrap(llfs_dir_insert(w, f, dir));
+    return write_buffer_name(w, f->inode_loc, dir.name, inode_map[dir.inode - 1]);
+}
+
+/**
+ * Write the inode block of a file to the buffer. If the file data is stored inline it
+ * is written into the same block directly after the inode.
+ * @param w - A write buffer object
+ * @param f - The file whose inode is being written
+ * @return llfs_error
+ */
+llfs_error write_buffer_inode(llfs_write_buffer *w, llfs_file *f) {
+    char buffer[BLOCK_SIZE] = { 0 };
+    memcpy(buffer, &f->inode, sizeof(llfs_inode));
+
+    if (f->inode.flags.inline_data && f->direct[0].block_data != NULL) {
+        memcpy(buffer + sizeof(llfs_inode), f->direct[0].block_data, f->inode.file_size);
+    }
+
+    return write_buffer_any(w, buffer, BLOCK_SIZE, f->inode_loc);
+}
+
+/**
+ * Write any data to the buffer. If the block is already in the buffer its copy is replaced.
+ * @param w - A write buffer object
+ * @param content - The content to be stored in the buffer
+ * @param size - The size of the content in bytes. Should be a maximum of BLOCK_SIZE
+ * @param block - Block number which the data will be written to
+ * @return llfs_error
+ */
+llfs_error write_buffer_any(llfs_write_buffer *w, void *content, int size, int block) {
+    file_block *existing = write_buffer_find(w, block);
+    if (existing != NULL && existing->t == FB_OWNED) {
+        memset(existing->block_data, 0, BLOCK_SIZE);
+        memcpy(existing->block_data, content, size);
+        return 0;
+    }
+
+    char *buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
+    if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+
+    memcpy(buffer, content, size);
+    file_block f = { block, buffer, FB_OWNED };
+    write_buffer_append(w, f);
+
+    return 0;
+}
+
+llfs_error llfs_search_dir(llfs_file *f, char *next_level, int *inode_block) {
+    file_block fb;
+    dir_record *r;
+    unwrap(llfs_dir_find(f, next_level, &fb, &r, NULL));
+
+    *inode_block = inode_map[r->inode - 1];
+    return 0;
+}
+
+/**
+ * Add an entry for a new inode to a directory which is already open. The inode block and number
+ * are reserved and the directory, its inode and the inode map are added to the buffer, the caller
+ * adds the new inode itself at inode_block.
+ * @param dir - The open parent directory
+ * @param name - The name of the new file
+ * @param w - A write buffer object
+ * @param inode_block - Set to the block reserved for the new inode
+ * @return llfs_error
+ */
+llfs_error llfs_link_entry(llfs_file *dir, char *name, llfs_write_buffer *w, int *inode_block) {
+    if (name[0] == '\0' || strchr(name, '/') != NULL || strlen(name) > LLFS_NAME_MAX) return BAD_PATH_ERROR;
+
+    int test_block = 0;
+    llfs_error e = llfs_search_dir(dir, name, &test_block);
+    if (e == 0) return FILE_ALREADY_EXISTS_ERROR;
+    if (e != FILE_NOT_FOUND_ERROR) return e;
+
+    int inode_num = 0, map_block = 0;
+    unwrap(llfs_reserve_blocks(inode_block, 1, free_block_map, BLOCK_SIZE));
+    unwrap(llfs_reserve_inode(*inode_block, inode_map, MAX_INODES, &map_block, &inode_num));
+
+    dir_entry d = { inode_num };
+    strncpy(d.name, name, LLFS_NAME_MAX);
+    unwrap(llfs_dir_append(w, dir, d));
+    unwrap(write_buffer_any(w, &dir->inode, sizeof(llfs_inode), dir->inode_loc));
+
+    return write_buffer_any(w, inode_map + (128 * map_block), sizeof(uint32_t) * 128, INODE_MAP_LOC + map_block);
+}
+
+/**
+ * Add a directory entry for a new inode. The inode block and number are reserved and the
+ * directory, its inode and the inode map are added to the buffer, the caller adds the new
+ * inode itself at inode_block. The directory is left open since the buffer can reference its
+ * block maps, the caller destroys it once the buffer is committed.
+ * @param path - The path to the new file including the files name
+ * @param dir - A file to open the parent directory in
+ * @param w - A write buffer object
+ * @param inode_block - Set to the block reserved for the new inode
+ * @return llfs_error
+ */
+llfs_error llfs_link_inode(char *path, llfs_file *dir, llfs_write_buffer *w, int *inode_block) {
+    char *dir_path = calloc((strlen(path) + 1), sizeof(char));
+    char *file_name = calloc((strlen(path) + 1), sizeof(char));
+    memset(dir, 0, sizeof(llfs_file));
+    llfs_error e = llfs_get_file(path, file_name, dir_path);
+    if (e != 0) goto free_exit;
+
+    int inode_loc;
+    llfs_inode dir_inode;
+    e = llfs_get_inode(dir_path, &dir_inode, &inode_loc);
+    if (e == FILE_NOT_FOUND_ERROR) {
+        e = BAD_PATH_ERROR;
+        goto free_exit;
+    }
+    if (e != 0 && e != EMPTY_FILE_ERROR) goto free_exit;
+
+    e = llfs_open_file(&dir_inode, dir, inode_loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) goto free_exit;
+
+    e = llfs_link_entry(dir, file_name, w, inode_block);
+
+    free_exit:
+    free(dir_path);
+    free(file_name);
+    return e;
+}
+
+/**
+ * Create a new file.
+ * @param path - The path to the new file including the files name
+ * @param t - The type of the new file. Either flat or dir
+ * @return llfs_error
+ */
+llfs_error llfs_create_file(char *path, file_type t) {
+    llfs_write_buffer w = { NULL, 0 };
+    llfs_inode node = { 0, { t, 0 }, { 0 }, 0, 0 };
+    llfs_file dir;
+
+    int inode_block = 0;
+    llfs_error e = llfs_link_inode(path, &dir, &w, &inode_block);
+    if (e != 0) goto free_exit;
+
+    e = write_buffer_any(&w, &node, sizeof(llfs_inode), inode_block);
+    if (e != 0) goto free_exit;
+
+    e = write_buffer_any(&w, (void *) free_block_map, BLOCK_SIZE, FREE_BLOCK_LOC);
+    if (e != 0) goto free_exit;
+
+    e = llfs_commit(&w);
+
+    /**
+     * I know people hate goto but I do not understand why if the code is jumping to a very clear
+     * location like this people still disapprove.
+     */
+    free_exit:
+    write_buffer_destroy(&w);
+    llfs_destroy_file(&dir);
+
+    return e;
+}
+
+/**
+ * Get the most blocks linking one more name into a directory can add to a write buffer. Besides
+ * the new inode, its inode map block, the directory inode and the free block map, a name which
+ * fits in its block only changes that block. Otherwise a linear directory either gains a block
+ * or is converted, rewriting every block and adding two, and a hashed one splits its leaf,
+ * which for a long name can happen twice. A new block can also change three block map blocks.
+ * @param dir - The open directory
+ * @param name - The name to link
+ * @return The number of blocks
+ */
+int llfs_link_cost(llfs_file *dir, const char *name) {
+    const int needed = DIR_REC_LEN(strlen(name));
+    const int blocks = dir->inode.flags.dir_blocks;
+    file_block fb;
+
+    if (dir->inode.flags.dir_index) {
+        if (llfs_dir_leaf(dir, llfs_name_hash(name), &fb, NULL) == 0 && llfs_block_room(fb.block_data) >= needed) return 5;
+        return 4 + 4 + 3;
+    }
+
+    for (int i = dir->inode.flags.dir_free; i < blocks; i++) {
+        if (llfs_get_block(dir, i * BLOCK_SIZE, &fb) != 0 || fb.block_data == NULL) break;
+        if (llfs_block_room(fb.block_data) >= needed) return 5;
+    }
+
+    if (dir->inode.flags.type == DIR && blocks >= DIR_INDEX_BLOCKS) return 4 + blocks + 2 + 3;
+    return 4 + 1 + 3;
+}
+
+/**
+ * Commit the files linked into a write buffer so far along with the free block map. The
+ * directories the files were linked into stay open and up to date so more can be added.
+ * @param w - The write buffer holding the new files, left empty
+ * @param dirs - The directories which were linked into
+ * @param count - The number of directories
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_commit_links(llfs_write_buffer *w, llfs_file *dirs, int count) {
+    llfs_error e = 0;
+    if (w->num_blocks > 0) e = write_buffer_any(w, (void *) free_block_map, BLOCK_SIZE, FREE_BLOCK_LOC);
+    if (e == 0) e = llfs_commit(w);
+
+    write_buffer_destroy(w);
+    *w = (llfs_write_buffer) { NULL, 0, NULL, 0 };
+    for (int i = 0; i < count; i++) {
+        if (dirs[i].iref != NULL) dirs[i].iversion = dirs[i].iref->version;
+    }
+
+    return e;
+}
+
+/**
+ * Create many files in one directory. The directory is only resolved and opened once, and since
+ * every file in a transaction shares the directory block, the directory inode and the maps the
+ * files are committed together in as few transactions as fit in the journal. When a name fails
+ * the inodes and blocks taken for the files not committed yet are released again.
+ * @param dir_path - The path of the directory to create the files in
+ * @param names - The names of the new files
+ * @param count - The number of names
+ * @param t - The type of the new files. Either flat or dir
+ * @param created - Set to the number of files created, every name before it was created. Can be NULL
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_create_many(char *dir_path, char **names, int count, file_type t, int *created) {
+    llfs_write_buffer w = { NULL, 0 };
+    llfs_inode node = { 0, { t, 0 }, { 0 }, 0, 0 };
+    llfs_file dir;
+    memset(&dir, 0, sizeof(llfs_file));
+    int done = 0, linked = 0;
+
+    // Saved again after every commit so a failure only releases what was not committed
+    map_state *saved = (map_state *) malloc(sizeof(map_state));
+    if (saved == NULL) return MEMORY_ALLOC_ERROR;
+    llfs_maps_save(saved);
+
+    int inode_loc;
+    llfs_inode dir_inode;
+    llfs_error e = llfs_get_inode(dir_path, &dir_inode, &inode_loc);
+    if (e == FILE_NOT_FOUND_ERROR) e = BAD_PATH_ERROR;
+    if (e != 0 && e != EMPTY_FILE_ERROR) goto free_exit;
+    if (dir_inode.flags.type != DIR) { e = BAD_PATH_ERROR; goto free_exit; }
+
+    e = llfs_open_file(&dir_inode, &dir, inode_loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) goto free_exit;
+
+    e = 0;
+    for (int i = 0; i < count && e == 0; i++) {
+        // Commit what is linked so far when the next name may not fit in the same transaction
+        if (w.num_blocks > 0 && w.num_blocks + llfs_link_cost(&dir, names[i]) > journal_max_transaction()) {
+            e = llfs_commit_links(&w, &dir, 1);
+            if (e != 0) break;
+            done = linked;
+            llfs_maps_save(saved);
+        }
+
+        int inode_block = 0;
+        e = llfs_link_entry(&dir, names[i], &w, &inode_block);
+        if (e == 0) e = write_buffer_any(&w, &node, sizeof(llfs_inode), inode_block);
+        if (e != 0) break;
+        linked++;
+    }
+
+    // The files linked before a name which already exists or is invalid are still created
+    if (e == 0 || e == FILE_ALREADY_EXISTS_ERROR || e == BAD_PATH_ERROR) {
+        llfs_error ce = llfs_commit_links(&w, &dir, 1);
+        if (ce == 0) llfs_maps_save(saved);
+        if (ce == 0) done = linked; else e = ce;
+    }
+
+    free_exit:
+    if (e != 0) llfs_maps_restore(saved);
+    if (created != NULL) *created = done;
+    free(saved);
+    write_buffer_destroy(&w);
+    llfs_destroy_file(&dir);
+    return e;
+}
+
+/**
+ * Create a directory along with any of its parents which do not exist yet. Each level of the
+ * path is searched once starting from the root, and all of the missing directories are created
+ * in as few transactions as fit in the journal.
+ * @param path - The absolute path of the directory
+ * @return llfs_error or 0 for success, including when the directory already exists
+ */
+llfs_error llfs_create_dirs(char *path) {
+    if (path[0] != '/') return BAD_PATH_ERROR;
+
+    const int path_len = strlen(path);
+    char *name = (char *) calloc(path_len + 1, sizeof(char));
+    llfs_file *dirs = (llfs_file *) calloc(path_len + 1, sizeof(llfs_file));
+    llfs_write_buffer w = { NULL, 0 };
+    llfs_inode node = { 0, { DIR, 0 }, { 0 }, 0, 0 };
+    map_state *saved = (map_state *) malloc(sizeof(map_state));
+    int open = 0;
+
+    llfs_error e = MEMORY_ALLOC_ERROR;
+    if (name == NULL || dirs == NULL || saved == NULL) goto free_exit;
+    llfs_maps_save(saved);
+
+    int inode_loc;
+    llfs_inode inode;
+    e = llfs_get_inode("/", &inode, &inode_loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) goto free_exit;
+    e = llfs_open_file(&inode, &dirs[open++], inode_loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) goto free_exit;
+
+    e = 0;
+    for (char *start = path; e == 0 && *start != '\0';) {
+        while (*start == '/') start++;
+        const int len = strcspn(start, "/");
+        if (len == 0) break;
+        if (len > LLFS_NAME_MAX) { e = BAD_PATH_ERROR; break; }
+        memcpy(name, start, len);
+        name[len] = '\0';
+        start += len;
+
+        llfs_file *parent = &dirs[open - 1];
+        e = llfs_search_dir(parent, name, &inode_loc);
+        if (e == 0) {
+            e = llfs_open_inode(&inode, inode_loc);
+            if (e == 0 && inode.flags.type != DIR) e = BAD_PATH_ERROR;
+            if (e == 0) e = llfs_open_file(&inode, &dirs[open++], inode_loc);
+            if (e == EMPTY_FILE_ERROR) e = 0;
+            continue;
+        }
+        if (e != FILE_NOT_FOUND_ERROR) break;
+
+        if (w.num_blocks > 0 && w.num_blocks + llfs_link_cost(parent, name) > journal_max_transaction()) {
+            e = llfs_commit_links(&w, dirs, open);
+            if (e != 0) break;
+            llfs_maps_save(saved);
+        }
+
+        e = llfs_link_entry(parent, name, &w, &inode_loc);
+        if (e == 0) e = write_buffer_any(&w, &node, sizeof(llfs_inode), inode_loc);
+        if (e != 0) break;
+
+        // The new directory is not on the disk yet so it is kept out of the inode cache
+        e = llfs_open_file(&node, &dirs[open++], 0);
+        if (e == EMPTY_FILE_ERROR) e = 0;
+        dirs[open - 1].inode_loc = inode_loc;
+    }
+
+    if (e == 0) e = llfs_commit_links(&w, dirs, open);
+
+    free_exit:
+    if (e != 0 && saved != NULL) llfs_maps_restore(saved);
+    free(saved);
+    write_buffer_destroy(&w);
+    for (int i = 0; dirs != NULL && i < open; i++) llfs_destroy_file(&dirs[i]);
+    free(dirs);
+    free(name);
+    return e;
+}
+
+/**
+ * Open the directory holding the last component of a path. Relative paths are resolved starting
+ * from the directory at dir_loc and absolute paths from the root.
+ * @param dir_loc - The inode block of the directory relative paths start from
+ * @param path - The path of the file
+ * @param dir - A file to open the parent directory in, can be destroyed even on error
+ * @param name - Set to the last component of the path, points into path
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_open_parent(int dir_loc, char *path, llfs_file *dir, char **name) {
+    memset(dir, 0, sizeof(llfs_file));
+    char *slash = strrchr(path, '/');
+    *name = slash == NULL ? path : slash + 1;
+    if (**name == '\0') return BAD_PATH_ERROR;
+
+    int inode_loc = dir_loc;
+    llfs_inode inode;
+    llfs_error e;
+    if (slash == NULL) {
+        e = llfs_open_inode(&inode, inode_loc);
+    } else if (slash == path) {
+        e = llfs_get_inode("/", &inode, &inode_loc);
+    } else {
+        char *dir_path = (char *) calloc(slash - path + 1, sizeof(char));
+        if (dir_path == NULL) return MEMORY_ALLOC_ERROR;
+        memcpy(dir_path, path, slash - path);
+        e = llfs_get_inode_at(dir_loc, dir_path, &inode, &inode_loc);
+        free(dir_path);
+    }
+    if (e != 0 && e != EMPTY_FILE_ERROR) return e;
+    if (inode.flags.type != DIR) return BAD_PATH_ERROR;
+
+    e = llfs_open_file(&inode, dir, inode_loc);
+    return e == EMPTY_FILE_ERROR ? 0 : e;
+}
+
+/**
+ * Create a new file. Relative paths are resolved starting from the directory at dir_loc so
+ * creating files in a directory which is already known only searches that directory.
+ * @param dir_loc - The inode block of the directory relative paths start from
+ * @param path - The path to the new file including the files name
+ * @param t - The type of the new file. Either flat or dir
+ * @return llfs_error
+ */
+llfs_error llfs_create_at(int dir_loc, char *path, file_type t) {
+    llfs_write_buffer w = { NULL, 0 };
+    llfs_inode node = { 0, { t, 0 }, { 0 }, 0, 0 };
+    llfs_file dir;
+    char *name;
+
+    int inode_block = 0;
+    llfs_error e = llfs_open_parent(dir_loc, path, &dir, &name);
+    if (e == FILE_NOT_FOUND_ERROR) e = BAD_PATH_ERROR;
+    if (e != 0) goto free_exit;
+
+    e = llfs_link_entry(&dir, name, &w, &inode_block);
+    if (e != 0) goto free_exit;
+
+    e = write_buffer_any(&w, &node, sizeof(llfs_inode), inode_block);
+    if (e != 0) goto free_exit;
+
+    e = llfs_commit_links(&w, &dir, 1);
+
+    free_exit:
+    write_buffer_destroy(&w);
+    llfs_destroy_file(&dir);
+    return e;
+}
+
+/**
+ * Copy an indirect block of a file being cloned. Every data block it references gains a reference
+ * and the copy is written to a newly reserved block.
+ * @param loc - The block number of the indirect block to copy
+ * @param count - The number of data blocks the indirect block references
+ * @param w - A write buffer to add the copy to
+ * @param copy_loc - Set to the block number of the copy
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_clone_indirect(int loc, int count, llfs_write_buffer *w, uint32_t *copy_loc) {
+    uint32_t content[BLOCK_SIZE / sizeof(uint32_t)];
+    if (journal_read_block(loc, (char *) content) != 0) return DISK_ERROR;
+
+    for (int i = 0; i < count; i++) unwrap(llfs_ref_block(content[i]));
+
+    int block_num;
+    unwrap(llfs_reserve_blocks(&block_num, 1, free_block_map, BLOCK_SIZE));
+    unwrap(write_buffer_any(w, content, BLOCK_SIZE, block_num));
+    *copy_loc = block_num;
+    return 0;
+}
+
+/**
+ * Share the data blocks of an inode with a copy of it. The indirect blocks are copied so each
+ * file can later replace its own entries, the inode is updated to point at the copies.
+ * @param node - The inode being copied
+ * @param w - A write buffer to add the indirect block copies to
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_clone_blocks(llfs_inode *node, llfs_write_buffer *w) {
+    if (node->flags.inline_data) return 0;
+
+    const int pnum = REFS_PER_INDIRECT;
+    const int total_blocks = ceil((double) node->file_size / BLOCK_SIZE);
+    for (int i = 0; i < 10 && i < total_blocks; i++) unwrap(llfs_ref_block(node->direct[i]));
+
+    uint32_t copy_loc;
+    if (total_blocks > 10) {
+        const int count = total_blocks - 10 < pnum ? total_blocks - 10 : pnum;
+        unwrap(llfs_clone_indirect(node->indirect, count, w, &copy_loc));
+        node->indirect = copy_loc;
+    }
+
+    if (total_blocks > 10 + pnum) {
+        uint32_t content[BLOCK_SIZE / sizeof(uint32_t)];
+        if (journal_read_block(node->double_indirect, (char *) content) != 0) return DISK_ERROR;
+
+        int left = total_blocks - 10 - pnum;
+        for (int j = 0; left > 0; j++, left -= pnum) {
+            unwrap(llfs_clone_indirect(content[j], left < pnum ? left : pnum, w, &content[j]));
+        }
+
+        int block_num;
+        unwrap(llfs_reserve_blocks(&block_num, 1, free_block_map, BLOCK_SIZE));
+        unwrap(write_buffer_any(w, content, BLOCK_SIZE, block_num));
+        node->double_indirect = block_num;
+    }
+
+    return 0;
+}
+
+/**
+ * Create dst as a copy of the flat file src without copying its data. Both files share the data
+ * blocks until one of them writes to a block, which then gets a copy of its own. Only the inode
+ * and indirect blocks are written, so the cost depends on the size of the block maps rather
+ * than the size of the file.
+ * @param src - The path of the file to copy
+ * @param dst - The path of the new file
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_clone_file(char *src, char *dst) {
+    llfs_write_buffer copies = { NULL, 0 };
+    llfs_write_buffer link = { NULL, 0 };
+    llfs_file dir;
+    memset(&dir, 0, sizeof(llfs_file));
+
+    int src_loc;
+    llfs_inode node;
+    llfs_error e = llfs_get_inode(src, &node, &src_loc);
+    if (e == EMPTY_FILE_ERROR) e = FILE_NOT_FOUND_ERROR;
+    if (e != 0) return e;
+    if (node.flags.type != FLAT) return INVALID_OPTION_ERROR;
+
+    // The inode block holds the inline data of small files as well
+    char block[BLOCK_SIZE];
+    if (journal_read_block(src_loc, block) != 0) return DISK_ERROR;
+
+    map_state *saved = (map_state *) malloc(sizeof(map_state));
+    if (saved == NULL) return MEMORY_ALLOC_ERROR;
+    llfs_maps_save(saved);
+
+    int inode_block = 0;
+    e = llfs_link_inode(dst, &dir, &link, &inode_block);
+    if (e != 0) goto free_exit;
+
+    e = llfs_clone_blocks(&node, &copies);
+    if (e != 0) goto free_exit;
+
+    e = write_buffer_refs(&copies);
+    if (e != 0) goto free_exit;
+
+    memcpy(block, &node, sizeof(llfs_inode));
+    e = write_buffer_any(&link, block, BLOCK_SIZE, inode_block);
+    if (e != 0) goto free_exit;
+
+    e = write_buffer_any(&link, (void *) free_block_map, BLOCK_SIZE, FREE_BLOCK_LOC);
+    if (e != 0) goto free_exit;
+
+    // New references and copies land before anything links to them
+    e = llfs_commit_ordered(&copies, &link);
+
+    free_exit:
+    if (e != 0) {
+        llfs_maps_restore(saved);
+        if (inode_block != 0) llfs_dcache_forget(inode_block);
+    }
+    free(saved);
+    write_buffer_destroy(&copies);
+    write_buffer_destroy(&link);
+    llfs_destroy_file(&dir);
+    return e;
+}
+
+/**
+ * Open the directory at path so its entries can be changed
+ * @param path - The path of the directory
+ * @param dir - A file to open the directory in
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_open_dir(char *path, llfs_file *dir) {
+    int inode_loc;
+    llfs_inode inode;
+    llfs_error e = llfs_get_inode(path, &inode, &inode_loc);
+    if (e == FILE_NOT_FOUND_ERROR) return BAD_PATH_ERROR;
+    if (e != 0 && e != EMPTY_FILE_ERROR) return e;
+    if (inode.flags.type != DIR) return BAD_PATH_ERROR;
+
+    e = llfs_open_file(&inode, dir, inode_loc);
+    return e == EMPTY_FILE_ERROR ? 0 : e;
 }
 
-llfs_error llfs_write_bytes(llfs_write_buffer *w, llfs_file *f, const char *content, int num_bytes) {
-    int curr_block = curr_block(f->pointer_byte_loc);
-    int curr_byte = 0;
+/**
+ * Open a directory to be listed. No directory blocks are read until the first entry is.
+ * @param path - The path of the directory
+ * @param d - The directory to open
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_open(char *path, llfs_dir *d) {
+    int inode_loc;
+    llfs_inode inode;
+    llfs_error e = llfs_get_inode(path, &inode, &inode_loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) return e;
 
-    for (int i = 0; i < num_bytes; i++) {
-        if (f->inode.file_size == MAX_FILE_SIZE) return FILE_FULL_ERROR;
-        if (f->inode.file_size % BLOCK_SIZE == 0 && f->pointer_byte_loc == f->inode.file_size) {
-            int block_num;
-            unwrap(llfs_extend_file(f, w, 1, &block_num));
+    return llfs_dir_open_inode(inode_loc, d);
+}
 
-            char *buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
-            if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+/**
+ * Open the directory with the inode at inode_loc to be listed
+ * @param inode_loc - The inode block of the directory
+ * @param d - The directory to open
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_dir_open_inode(int inode_loc, llfs_dir *d) {
+    memset(d, 0, sizeof(llfs_dir));
+    d->inode_loc = inode_loc;
+    unwrap(llfs_open_inode(&d->inode, inode_loc));
+    if (d->inode.flags.type != DIR) return BAD_PATH_ERROR;
 
-            block_pos p;
-            file_block fb = { block_num, buffer, FB_OWNED };
+    d->block_data = (char *) calloc(BLOCK_SIZE, sizeof(char));
+    if (d->block_data == NULL) return MEMORY_ALLOC_ERROR;
 
-            llfs_error e = llfs_get_pos(f->inode.file_size, &p);
-            if (e != 0) { free(buffer); return e; }
+    d->block = -1;
+    d->entry = BLOCK_SIZE;
+    return 0;
+}
 
-            e = llfs_set_block(f, p, fb);
-            if (e != 0) { free(buffer); return e; }
-        }
+/**
+ * Read the directory block at d->block into memory, dropping the one read before it. The inode
+ * is looked up again first so a directory which grew since it was opened is listed to its end.
+ * @param d - The directory being listed
+ * @return llfs_error, END_OF_FILE_ERROR after the last block or 0 for success
+ */
+llfs_error llfs_dir_read_block(llfs_dir *d) {
+    unwrap(llfs_open_inode(&d->inode, d->inode_loc));
+    // The index of a hashed directory holds no entries
+    if (d->inode.flags.dir_index && d->block == 0) d->block = 1;
+    if (d->block >= d->inode.flags.dir_blocks) return END_OF_FILE_ERROR;
+
+    uint32_t block_num;
+    if (d->block < 10) {
+        block_num = d->inode.direct[d->block];
+    } else {
+        if (d->ind == NULL) d->ind = (uint32_t *) calloc(REFS_PER_INDIRECT, sizeof(uint32_t));
+        if (d->ind == NULL) return MEMORY_ALLOC_ERROR;
 
-        if (f->pointer_byte_loc % BLOCK_SIZE == 0) {
-            unwrap(llfs_seek(f, LLFS_SEEK_SET, f->pointer_byte_loc));
+        if (d->ind_loc != d->inode.indirect) {
+            if (journal_read_block(d->inode.indirect, (char *) d->ind) != 0) return DISK_ERROR;
+            d->ind_loc = d->inode.indirect;
         }
 
-        if (f->pointer_byte_loc == f->inode.file_size) {
-            f->inode.file_size ++;
-        }
+        block_num = d->ind[d->block - 10];
+    }
 
-        *f->loc_pointer = content[curr_byte];
-        curr_byte ++;
-        f->loc_pointer ++;
-        f->pointer_byte_loc ++;
-        int next_block = curr_block(f->pointer_byte_loc);
-        if (next_block != curr_block) {
-            file_block edited;
-            unwrap(llfs_get_block(f, f->pointer_byte_loc - 1, &edited));
-            unwrap(write_buffer_cpy(w, edited));
-        } else if (curr_byte >= num_bytes) {
-            file_block edited;
-            unwrap(llfs_get_block(f, f->pointer_byte_loc, &edited));
-            unwrap(write_buffer_cpy(w, edited));
+    if (journal_read_block(block_num, d->block_data) != 0) return DISK_ERROR;
+    return 0;
+}
+
+/**
+ * Read the next entry of a directory, skipping the holes left by removed entries
+ * @param d - The directory being listed
+ * @param entry - Set to the next entry
+ * @param inode - Set to the inode of the entry, may be NULL if it is not needed
+ * @return llfs_error, END_OF_FILE_ERROR after the last entry or 0 for success
+ */
+llfs_error llfs_dir_next(llfs_dir *d, dir_entry *entry, llfs_inode *inode) {
+    dir_record *next = NULL;
+    while (next == NULL) {
+        if (d->entry + sizeof(dir_record) > BLOCK_SIZE) {
+            d->block++;
+            d->entry = 0;
+            unwrap(llfs_dir_read_block(d));
         }
 
-        curr_block = next_block;
+        dir_record *r = (dir_record *) (d->block_data + d->entry);
+        d->entry += llfs_record_len(d->block_data, r);
+        if (r->inode != 0) next = r;
     }
 
+    *entry = llfs_record_entry(next);
+    if (inode != NULL) unwrap(llfs_open_inode(inode, inode_map[next->inode - 1]));
     return 0;
 }
 
-llfs_error llfs_write(char *content, int size, int count, llfs_file *file) {
-    llfs_write_buffer w = { NULL, 0 };
-    const int total_size = size * count;
+/**
+ * Free the memory held by a directory being listed
+ * @param d - The directory to close
+ */
+void llfs_dir_close(llfs_dir *d) {
+    free(d->ind);
+    free(d->block_data);
+    memset(d, 0, sizeof(llfs_dir));
+}
 
-    llfs_error e = llfs_write_bytes(&w, file, content, total_size);
-    if (e != 0) return e;
+/**
+ * Read a block for a tree walk. Walks read committed blocks without going through the caches,
+ * so the reads of every worker only have to be kept from interleaving on the disk file.
+ * @param walk - The walk doing the read
+ * @param block_num - The block to read
+ * @param block - Buffer to store the block data
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_walk_read(llfs_walk_state *walk, int block_num, char *block) {
+    pthread_mutex_lock(&walk->disk_lock);
+    llfs_error e = journal_read_block(block_num, block);
+    pthread_mutex_unlock(&walk->disk_lock);
+    return e;
+}
 
-    e = write_buffer_any(&w, &file->inode, sizeof(llfs_inode), file->inode_loc);
-    if (e != 0) { write_buffer_destroy(&w); return e; }
+/**
+ * Add a directory to the directories still to be walked and wake a worker to take it
+ * @param walk - The walk to add the directory to
+ * @param inode_loc - The inode block of the directory
+ * @param path - The path of the directory, owned by the walk from now on
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_walk_push(llfs_walk_state *walk, int inode_loc, char *path) {
+    llfs_error e = 0;
+    pthread_mutex_lock(&walk->lock);
+    if (walk->size == walk->capacity) {
+        const int capacity = walk->capacity == 0 ? 16 : walk->capacity * 2;
+        llfs_walk_item *grown = (llfs_walk_item *) realloc(walk->items, capacity * sizeof(llfs_walk_item));
+        if (grown == NULL) {
+            e = MEMORY_ALLOC_ERROR;
+        } else {
+            walk->items = grown;
+            walk->capacity = capacity;
+        }
+    }
 
-    e = write_buffer_any(&w, (void *) free_block_map, BLOCK_SIZE, FREE_BLOCK_LOC);
-    if (e != 0) { write_buffer_destroy(&w); return e; }
+    if (e == 0) {
+        llfs_walk_item item = { inode_loc, path };
+        walk->items[walk->size++] = item;
+        pthread_cond_signal(&walk->ready);
+    }
+    pthread_mutex_unlock(&walk->lock);
 
-    journal_new_transaction(w.blocks, w.num_blocks);
-    write_buffer_destroy(&w);
-    return 0;
+    if (e != 0) free(path);
+    return e;
 }
 
 /**
- * Append a file to the directory
- * @param w - write buffer to append events to
- * @param f - A file to write the data to
- * @param dir - The directory entry to add to the file
- * @return llfs_error
+ * Call back for every entry of one directory and queue its subdirectories
+ * @param walk - The walk the directory belongs to
+ * @param item - The directory to list
+ * @param block - A buffer of BLOCK_SIZE bytes
+ * @param ind - A buffer of BLOCK_SIZE bytes for the indirect block
+ * @return llfs_error or 0 for success
  */
-llfs_error llfs_dir_append(llfs_write_buffer *w, llfs_file *f, dir_entry dir) {
-    unwrap(llfs_seek(f, LLFS_SEEK_START, 0));
-    dir_entry *block = (dir_entry *) calloc (BLOCK_SIZE, sizeof(char));
-    if (block == NULL) return MEMORY_ALLOC_ERROR;
-
-    int block_num = 0;
-    llfs_error e = 0;
-    if (f->inode.file_size == BLOCK_SIZE * f->inode.flags.dir_blocks) {
-        e = llfs_extend_file(f, w, 1, &block_num);
-        if (e != 0) { free(block); return e; }
-        f->inode.flags.dir_blocks += 1;
-        memcpy(block, &dir, sizeof(dir_entry));
-    } else {
-        while (1) {
-            file_block fb;
-            e = llfs_get_block(f, f->pointer_byte_loc, &fb);
-            if (e != 0) { free(block); return e; }
-            block_num = fb.block_num;
-
-            llfs_error e = llfs_get_bytes(f, (char *) block, BLOCK_SIZE, 0);
-            if (e != 0 && e != END_OF_FILE_ERROR) return e;
-
-            for (int i = 0; i < BLOCK_SIZE / sizeof(dir_entry); i++) {
-                if (block[i].inode == 0) {
-                    block[i] = dir;
-                    goto break_loop;
-                }
+llfs_error llfs_walk_dir(llfs_walk_state *walk, llfs_walk_item *item, char *block, uint32_t *ind) {
+    llfs_inode dir;
+    unwrap(llfs_walk_read(walk, item->inode_loc, block));
+    memcpy(&dir, block, sizeof(llfs_inode));
+    if (dir.flags.type != DIR) return BAD_PATH_ERROR;
+    if (dir.flags.dir_blocks > 10) unwrap(llfs_walk_read(walk, dir.indirect, (char *) ind));
+
+    const int path_len = strlen(item->path);
+    for (int i = dir.flags.dir_index ? 1 : 0; i < dir.flags.dir_blocks; i++) {
+        unwrap(llfs_walk_read(walk, i < 10 ? dir.direct[i] : ind[i - 10], block));
+
+        for (dir_record *r = (dir_record *) block; r != NULL; r = llfs_record_next(block, r)) {
+            if (r->inode == 0) continue;
+
+            const dir_entry entry = llfs_record_entry(r);
+            const int loc = inode_map[entry.inode - 1];
+            char *path = (char *) malloc(path_len + strlen(entry.name) + 2);
+            if (path == NULL) return MEMORY_ALLOC_ERROR;
+            sprintf(path, "%s/%s", path_len == 1 ? "" : item->path, entry.name);
+
+            char inode_block[BLOCK_SIZE];
+            llfs_inode inode;
+            llfs_error e = llfs_walk_read(walk, loc, inode_block);
+            if (e == 0) {
+                memcpy(&inode, inode_block, sizeof(llfs_inode));
+                e = walk->fn(path, &inode, walk->arg);
             }
+            if (e != 0) { free(path); return e; }
 
-            if (f->pointer_byte_loc == f->inode.file_size) return FILE_FULL_ERROR;
+            if (inode.flags.type == DIR) {
+                unwrap(llfs_walk_push(walk, loc, path));
+            } else {
+                free(path);
+            }
         }
-        break_loop: ;
     }
 
-    file_block fb = { block_num, (char *) block, FB_OWNED };
-    block_pos p;
+    return 0;
+}
 
-    f->inode.file_size += sizeof(dir_entry);
-    e = write_buffer_any(w, block, BLOCK_SIZE, block_num);
-    if (e != 0 && e != BUFFER_DUPLICATE_ERROR) { free(block); return e; }
-    e = llfs_get_pos(curr_block(f->inode.file_size), &p);
-    if (e != 0) { free(block); return e; }
-    e = llfs_set_block(f, p, fb);
-    if (e != 0) { free(block); return e; }
+/**
+ * Worker of a tree walk. Takes directories off the shared stack until every directory has been
+ * walked or one of the workers fails.
+ * @param arg - The walk
+ * @return NULL
+ */
+void *llfs_walk_worker(void *arg) {
+    llfs_walk_state *walk = (llfs_walk_state *) arg;
+    char *block = (char *) malloc(BLOCK_SIZE);
+    uint32_t *ind = (uint32_t *) malloc(BLOCK_SIZE);
+
+    pthread_mutex_lock(&walk->lock);
+    if (block == NULL || ind == NULL) walk->error = MEMORY_ALLOC_ERROR;
+    while (walk->error == 0) {
+        // The walk is over once nothing is queued and no worker can queue anything else
+        if (walk->size == 0 && walk->busy == 0) break;
+        if (walk->size == 0) {
+            pthread_cond_wait(&walk->ready, &walk->lock);
+            continue;
+        }
 
-    return 0;
+        llfs_walk_item item = walk->items[--walk->size];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->lock);
+
+        llfs_error e = llfs_walk_dir(walk, &item, block, ind);
+        free(item.path);
+
+        pthread_mutex_lock(&walk->lock);
+        walk->busy--;
+        if (e != 0 && walk->error == 0) walk->error = e;
+    }
+
+    // Wake the other workers so they see the walk is over
+    pthread_cond_broadcast(&walk->ready);
+    pthread_mutex_unlock(&walk->lock);
+    free(block);
+    free(ind);
+    return NULL;
 }
 
 /**
- * Write any data to the buffer
- * @param w - A write buffer object
- * @param content - The content to be stored in the buffer
- * @param size - The size of the content in bytes. Should be a maximum of BLOCK_SIZE
- * @param block - Block number which the data will be written to
- * @return llfs_error
+ * Call fn for every file and directory below a directory. The tree is walked by inode, each
+ * directory is listed once by whichever worker thread takes it off a shared stack of directories
+ * still to be walked, so separate branches of the tree are walked in parallel. Entries are not
+ * passed to fn in any particular order and fn is called from several threads at once. Nothing
+ * may change the file system while it is being walked.
+ * @param root - The absolute path of the directory to walk, which is not passed to fn itself
+ * @param fn - Called with the path and inode of each entry, returning an error stops the walk
+ * @param arg - Passed to fn
+ * @param nthreads - The number of worker threads, up to LLFS_WALK_MAX_THREADS
+ * @return llfs_error, the error returned by fn or 0 for success
  */
-llfs_error write_buffer_any(llfs_write_buffer *w, void *content, int size, int block) {
-    char *buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
-    if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+llfs_error llfs_walk_tree(char *root, llfs_walk_fn fn, void *arg, int nthreads) {
+    if (nthreads < 1 || nthreads > LLFS_WALK_MAX_THREADS || fn == NULL) return INVALID_OPTION_ERROR;
 
-    memcpy(buffer, content, size);
-    file_block f = { block, buffer, FB_OWNED };
-    write_buffer_append(w, f);
+    int inode_loc;
+    llfs_inode inode;
+    llfs_error e = llfs_get_inode(root, &inode, &inode_loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) return e;
+    if (inode.flags.type != DIR) return BAD_PATH_ERROR;
+
+    // Paths are built as parent/name so the root is stored without a trailing slash
+    char *path = (char *) malloc(strlen(root) + 1);
+    if (path == NULL) return MEMORY_ALLOC_ERROR;
+    strcpy(path, root);
+    for (int len = strlen(path); len > 1 && path[len - 1] == '/'; len--) path[len - 1] = '\0';
+
+    llfs_walk_state walk;
+    memset(&walk, 0, sizeof(llfs_walk_state));
+    walk.fn = fn;
+    walk.arg = arg;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_mutex_init(&walk.disk_lock, NULL);
+    pthread_cond_init(&walk.ready, NULL);
+
+    e = llfs_walk_push(&walk, inode_loc, path);
+    pthread_t threads[LLFS_WALK_MAX_THREADS];
+    int started = 0;
+    for (; e == 0 && started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, llfs_walk_worker, &walk) != 0) break;
+    }
 
-    return 0;
+    if (started == 0 && e == 0) {
+        e = MEMORY_ALLOC_ERROR;
+    }
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    if (e == 0) e = walk.error;
+
+    for (int i = 0; i < walk.size; i++) free(walk.items[i].path);
+    free(walk.items);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_mutex_destroy(&walk.disk_lock);
+    pthread_cond_destroy(&walk.ready);
+    return e;
 }
 
-llfs_error llfs_search_dir(llfs_file *f, char *next_level, int *inode_block) {
-    unwrap(llfs_seek(f, LLFS_SEEK_START, 0));
+/**
+ * Remove a flat file which is being replaced by a rename. The entry, inode and data blocks are
+ * released in memory and the changed maps are added to the buffer.
+ * @param w - A write buffer object
+ * @param dir - The directory holding the file
+ * @param name - The name of the file in the directory
+ * @param inode_loc - The block of the files inode
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_replace_file(llfs_write_buffer *w, llfs_file *dir, char *name, int inode_loc) {
+    llfs_inode inode;
+    unwrap(llfs_open_inode(&inode, inode_loc));
+    if (inode.flags.type != FLAT) return FILE_ALREADY_EXISTS_ERROR;
 
-    dir_entry *buffer = (dir_entry *) calloc(BLOCK_SIZE, sizeof(char));
-    if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+    llfs_file file;
+    llfs_error e = llfs_open_file(&inode, &file, inode_loc);
+    if (e != 0 && e != EMPTY_FILE_ERROR) return e;
 
-    int total_blocks = ceil(((double) f->inode.file_size) / BLOCK_SIZE);
     int inode_num = 0;
-    llfs_error e = 0;
-    for (int i = 0; i < total_blocks; i++) {
-        e = llfs_get_bytes(f, (char *) buffer, BLOCK_SIZE, 1);
-        if (e != 0 && e != END_OF_FILE_ERROR) break;
-        else e = 0;
-
-        for (int j = 0; j < BLOCK_SIZE / sizeof(dir_entry); j++) {
-            if (strcmp(buffer[j].name, next_level) == 0 && buffer[j].inode != 0) {
-                inode_num = buffer[j].inode;
-                goto break_loop;
-            }
-        }
-    }
-    break_loop:;
-    if (inode_num != 0) {
-        *inode_block = inode_map[inode_num - 1];
-    } else {
-        e = FILE_NOT_FOUND_ERROR;
-    }
+    e = llfs_dir_remove(w, dir, name, &inode_num);
+    if (e == 0) e = llfs_free_file_blocks(&file);
+    if (e == 0) e = llfs_free_inode(inode_num, inode_map, MAX_INODES);
+    llfs_dcache_forget(inode_loc);
+    llfs_destroy_file(&file);
+    if (e != 0) return e;
 
-    free(buffer);
-    return e;
+    const int map_block = (inode_num - 1) / 128;
+    return write_buffer_any(w, inode_map + (128 * map_block), sizeof(uint32_t) * 128, INODE_MAP_LOC + map_block);
 }
 
 /**
- * Create a new file.
- * @param path - The path to the new file including the files name
- * @param t - The type of the new file. Either flat or dir
- * @return llfs_error
+ * Move the entry at old_path to new_path, which can be in another directory. Only the directory
+ * entries change, the inode and data of the file are left where they are. An existing flat file
+ * at new_path is replaced. Both directories, and any file being replaced, are updated in a
+ * single transaction so a crash leaves the file at exactly one of the two paths.
+ * @param old_path - The current path of the file
+ * @param new_path - The path to move the file to
+ * @return llfs_error or 0 for success
  */
-llfs_error llfs_create_file(char *path, file_type t) {
-    char *dir_path = calloc((strlen(path) + 1), sizeof(char));
-    char *file_name = calloc((strlen(path) + 1), sizeof(char));
+llfs_error llfs_rename_file(char *old_path, char *new_path) {
+    const size_t old_len = strlen(old_path);
+    char *old_dir = calloc(old_len + 1, sizeof(char));
+    char *old_name = calloc(old_len + 1, sizeof(char));
+    char *new_dir = calloc(strlen(new_path) + 1, sizeof(char));
+    char *new_name = calloc(strlen(new_path) + 1, sizeof(char));
     llfs_write_buffer w = { NULL, 0 };
-    llfs_inode node = { 0, { t, 0 }, { 0 }, 0, 0 };
-    llfs_error e = llfs_get_file(path, file_name, dir_path);
-    if (e != 0) goto free_exit;
+    llfs_file src, other;
+    memset(&src, 0, sizeof(llfs_file));
+    memset(&other, 0, sizeof(llfs_file));
+    llfs_file *dst = &src;
 
-    int inode_loc;
-    llfs_inode dir_inode;
-    llfs_file file;
-    e = llfs_get_inode(dir_path, &dir_inode, &inode_loc);
-    if (e == FILE_NOT_FOUND_ERROR) {
-        e = BAD_PATH_ERROR;
+    llfs_error e = 0;
+    if (old_dir == NULL || old_name == NULL || new_dir == NULL || new_name == NULL) {
+        e = MEMORY_ALLOC_ERROR;
         goto free_exit;
     }
-    if (e != 0 && e != EMPTY_FILE_ERROR) goto free_exit;
 
-    e = llfs_open_file(&dir_inode, &file, inode_loc);
-    if (e != 0 && e != EMPTY_FILE_ERROR) goto free_exit;
+    e = llfs_get_file(old_path, old_name, old_dir);
+    if (e != 0) goto free_exit;
+    e = llfs_get_file(new_path, new_name, new_dir);
+    if (e != 0) goto free_exit;
 
-    int test_block = 0;
-    e = llfs_search_dir(&file, file_name, &test_block);
-    if (e != 0 && e != FILE_NOT_FOUND_ERROR) goto free_exit;
-    if (e != FILE_NOT_FOUND_ERROR) {
-        e = FILE_ALREADY_EXISTS_ERROR;
+    // A directory can not be moved inside of itself
+    if (strncmp(new_path, old_path, old_len) == 0 && new_path[old_len] == '/') {
+        e = BAD_PATH_ERROR;
         goto free_exit;
     }
 
-    int inode_block = 0, inode_num = 0, map_block = 0;
-    e = llfs_reserve_blocks(&inode_block, 1, free_block_map, BLOCK_SIZE);
+    e = llfs_open_dir(old_dir, &src);
+    if (e == BAD_PATH_ERROR) e = FILE_NOT_FOUND_ERROR;
     if (e != 0) goto free_exit;
 
-    e = llfs_reserve_inode(inode_block, inode_map, MAX_INODES, &map_block, &inode_num);
-    if (e != 0) goto free_exit;
+    int inode_loc = 0, target_loc = 0;
+    e = llfs_search_dir(&src, old_name, &inode_loc);
+    if (e != 0 || strcmp(old_path, new_path) == 0) goto free_exit;
 
-    dir_entry d = { inode_num };
-    strncpy(d.name, file_name, 31);
-    e = llfs_dir_append(&w, &file, d);
+    if (strcmp(old_dir, new_dir) != 0) {
+        e = llfs_open_dir(new_dir, &other);
+        if (e != 0) goto free_exit;
+        dst = &other;
+    }
+
+    e = llfs_search_dir(dst, new_name, &target_loc);
+    if (e == 0) {
+        llfs_inode inode;
+        e = llfs_open_inode(&inode, inode_loc);
+        if (e == 0 && inode.flags.type != FLAT) e = FILE_ALREADY_EXISTS_ERROR;
+        if (e == 0) e = llfs_replace_file(&w, dst, new_name, target_loc);
+    } else if (e == FILE_NOT_FOUND_ERROR) {
+        e = 0;
+    }
     if (e != 0) goto free_exit;
 
-    e = write_buffer_any(&w, &file.inode, sizeof(llfs_inode), inode_loc);
+    int inode_num = 0;
+    e = llfs_dir_remove(&w, &src, old_name, &inode_num);
     if (e != 0) goto free_exit;
 
-    e = write_buffer_any(&w, &node, sizeof(llfs_inode), inode_block);
+    dir_entry d = { inode_num };
+    strncpy(d.name, new_name, LLFS_NAME_MAX);
+    e = llfs_dir_append(&w, dst, d);
     if (e != 0) goto free_exit;
 
-    e = write_buffer_any(&w, inode_map + (128 * map_block), sizeof(uint32_t) * 128, INODE_MAP_LOC + map_block);
+    e = write_buffer_any(&w, &src.inode, sizeof(llfs_inode), src.inode_loc);
     if (e != 0) goto free_exit;
 
+    if (dst != &src) {
+        e = write_buffer_any(&w, &dst->inode, sizeof(llfs_inode), dst->inode_loc);
+        if (e != 0) goto free_exit;
+    }
+
     e = write_buffer_any(&w, (void *) free_block_map, BLOCK_SIZE, FREE_BLOCK_LOC);
     if (e != 0) goto free_exit;
 
-    e = journal_new_transaction(w.blocks, w.num_blocks);
+    e = llfs_commit(&w);
 
-    /**
-     * I know people hate goto but I do not understand why if the code is jumping to a very clear
-     * location like this people still disapprove.
-     */
     free_exit:
     write_buffer_destroy(&w);
-    free(dir_path);
-    free(file_name);
-
+    llfs_destroy_file(&src);
+    llfs_destroy_file(&other);
+    free(old_dir);
+    free(old_name);
+    free(new_dir);
+    free(new_name);
     return e;
 }
 
 llfs_error llfs_destroy_file(llfs_file *file) {
-    unwrap(llfs_seek(file, LLFS_SEEK_START, 0));
-
-    int loc = file->pointer_byte_loc;
-    while (loc < file->inode.file_size) {
-        free(file->loc_pointer);
-        loc += BLOCK_SIZE;
-        if (loc >= file->inode.file_size) break;
-        unwrap(llfs_seek(file, LLFS_SEEK_SET, loc));
-    }
+    for (int i = 0; i < 10; i++) free(file->direct[i].block_data);
 
-    if (file->inode.file_size > 10 * BLOCK_SIZE) {
-        free(file->ind.content);
+    if (file->ind.blocks != NULL) {
+        for (int i = 0; i < REFS_PER_INDIRECT; i++) free(file->ind.blocks[i].block_data);
         free(file->ind.blocks);
     }
+    free(file->ind.content);
 
-    int blocks_left = curr_block(file->inode.file_size) - 138;
-    if (blocks_left == 0) return 0;
-
-    int double_indirect = ceil((double) blocks_left / REFS_PER_INDIRECT);
-    for (int i = 0; i < double_indirect; i++) {
-        free(file->dind.blocks[i].blocks);
-    }
-
-    if (double_indirect > 0) {
+    if (file->dind.blocks != NULL) {
+        for (int j = 0; j < REFS_PER_INDIRECT; j++) {
+            if (file->dind.blocks[j].blocks == NULL) continue;
+            for (int i = 0; i < REFS_PER_INDIRECT; i++) free(file->dind.blocks[j].blocks[i].block_data);
+            free(file->dind.blocks[j].blocks);
+            free(file->dind.blocks[j].content);
+        }
         free(file->dind.blocks);
     }
+    free(file->dind.content);
+    if (file->iref != NULL && file->iref->refs > 0) file->iref->refs--;
 
+    memset(file, 0, sizeof(llfs_file));
     return 0;
 }
 
@@ -1184,6 +3380,8 @@ llfs_error llfs_extend_file(llfs_file *file, llfs_write_buffer *w, int num_block
 
     const int pnum = REFS_PER_INDIRECT;
     int next_loc = curr_block(file->inode.file_size);
+    // Directory sizes count entries so their blocks are counted separately
+    if (file->inode.flags.type == DIR) next_loc = file->inode.flags.dir_blocks;
     for (int i = 0; i < num_blocks; i ++) {
 
         if (next_loc < 10) { // Direct
@@ -1236,17 +3434,11 @@ llfs_error llfs_extend_file(llfs_file *file, llfs_write_buffer *w, int num_block
  * @return llfs_error or 0 for success.
  */
 llfs_error llfs_open_inode(llfs_inode *inode, int inode_loc) {
-    char *inode_buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
-    if (inode_buffer == NULL) return MEMORY_ALLOC_ERROR;
+    inode_ref *ref;
+    unwrap(llfs_icache_load(inode_loc, &ref));
+    if (ref == NULL) return llfs_read_inode(inode_loc, inode);
 
-    disk_error e = disk_read_block(inode_loc, inode_buffer);
-    if (e != 0) {
-        free(inode_buffer);
-        return DISK_ERROR;
-    }
-
-    memcpy(inode, inode_buffer, sizeof(llfs_inode));
-    free(inode_buffer);
+    *inode = ref->inode;
     return 0;
 }
 
@@ -1267,7 +3459,20 @@ int count_levels(char *path) {
  * @return llfs_error or 0 for success. Error if file not found
  */
 llfs_error llfs_get_inode(char *path, llfs_inode *inode, int *inode_loc) {
-    *inode_loc = ROOT_DIR_LOC;
+    return llfs_get_inode_at(root_dir_loc, path, inode, inode_loc);
+}
+
+/**
+ * Fetch the inode from disk. Relative paths are resolved starting from the directory at
+ * dir_loc and absolute paths from the root.
+ * @param dir_loc - The inode block of the directory relative paths start from
+ * @param path - The path to the inode to search for
+ * @param inode - The inode pointer to load the data into
+ * @param inode_loc - The block location of the inode as return value
+ * @return llfs_error or 0 for success. Error if file not found
+ */
+llfs_error llfs_get_inode_at(int dir_loc, char *path, llfs_inode *inode, int *inode_loc) {
+    *inode_loc = path[0] == '/' ? root_dir_loc : dir_loc;
     unwrap(llfs_open_inode(inode, *inode_loc));
     if (inode->file_size == 0) return EMPTY_FILE_ERROR;
 
@@ -1278,22 +3483,33 @@ llfs_error llfs_get_inode(char *path, llfs_inode *inode, int *inode_loc) {
     llfs_file f;
     llfs_error e = 0;
     char *tok = strtok(path_cpy, "/");
-    int levels = count_levels(path);
+    int levels = count_levels(path) + (path[0] != '/');
     int iter = 0;
     while (tok != NULL) {
-        e = llfs_open_file(inode, &f, *inode_loc);
-        if (iter != levels && e == EMPTY_FILE_ERROR) {
+        // Names resolved before come from the dentry cache without reading the directory
+        dentry *d = llfs_dcache_find(*inode_loc, tok);
+        if (d != NULL && d->inode_loc == 0) {
             e = FILE_NOT_FOUND_ERROR;
-        }
-        if (e != 0) break;
+            break;
+        } else if (d != NULL) {
+            *inode_loc = d->inode_loc;
+        } else {
+            const int parent = *inode_loc;
+            e = llfs_open_file(inode, &f, *inode_loc);
+            if (iter != levels && e == EMPTY_FILE_ERROR) {
+                e = FILE_NOT_FOUND_ERROR;
+            }
+            if (e != 0) break;
 
-        e = llfs_search_dir(&f, tok, inode_loc);
-        if (e != 0) break;
+            e = llfs_search_dir(&f, tok, inode_loc);
+            llfs_destroy_file(&f);
+            if (e == FILE_NOT_FOUND_ERROR) llfs_dcache_set(parent, tok, 0);
+            if (e != 0) break;
+            llfs_dcache_set(parent, tok, *inode_loc);
+        }
 
         tok = strtok(NULL, "/");
         llfs_open_inode(inode, *inode_loc);
-
-        llfs_destroy_file(&f);
         iter++;
     }
 
@@ -1312,7 +3528,7 @@ llfs_error create_root() {
     llfs_inode node = { 0, { DIR, 0 }, { 0 }, 0, 0 };
     memcpy(buffer, &node, sizeof(llfs_inode));
 
-    disk_error de = disk_write_block(ROOT_DIR_LOC, buffer);
+    disk_error de = disk_write_block(root_dir_loc, buffer);
     if (de != 0) return DISK_ERROR;
 
     free(buffer);
@@ -1332,11 +3548,11 @@ llfs_error inode_map_config() {
         if (de != 0) return DISK_ERROR;
     }
 
-    buffer[0] = ROOT_DIR_LOC;
+    memcpy(buffer, &root_dir_loc, sizeof(uint32_t));
     disk_error de = disk_write_block(INODE_MAP_LOC, buffer);
     if (de != 0) return DISK_ERROR;
 
-    inode_map[0] = ROOT_DIR_LOC;
+    inode_map[0] = root_dir_loc;
 
     free(buffer);
     return 0;
@@ -1347,7 +3563,20 @@ llfs_error inode_map_config() {
  * @return llfs_error or 0 on success
  */
 llfs_error llfs_load() {
-    disk_error de = disk_read_block(FREE_BLOCK_LOC, (char *) free_block_map);
+    super_block s;
+    char *buffer = (char *) malloc(BLOCK_SIZE);
+    if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+    disk_error de = disk_read_block(SUPER_BLOCK_LOC, buffer);
+    memcpy(&s, buffer, sizeof(super_block));
+    free(buffer);
+    if (de != 0) return DISK_ERROR;
+    root_dir_loc = s.root_dir_block;
+    journal_attach(s.journal_uuid);
+
+    // The maps are read after the journal is replayed so they include every committed change
+    unwrap(journal_recover());
+
+    de = disk_read_block(FREE_BLOCK_LOC, (char *) free_block_map);
     if (de != 0) return DISK_ERROR;
 
     de = disk_read_block(INODE_MAP_LOC, (char *) inode_map);
@@ -1355,7 +3584,34 @@ llfs_error llfs_load() {
     de = disk_read_block(INODE_MAP_LOC + 1u, (char *)&inode_map[MAX_INODES / INODE_MAP_SIZE]);
     if (de != 0) return DISK_ERROR;
 
-    return journal_recover();
+    for (int i = 0; i < REF_COUNT_SIZE; i++) {
+        de = disk_read_block(REF_COUNT_LOC + i, (char *) block_refs + i * BLOCK_SIZE);
+        if (de != 0) return DISK_ERROR;
+    }
+    refs_dirty = 0;
+    memset(dcache, 0, sizeof(dcache));
+    memset(icache, 0, sizeof(icache));
+
+    return 0;
+}
+
+/**
+ * Copy every committed change still waiting in the journal to its home location on the disk
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_sync() {
+    return journal_checkpoint();
+}
+
+/**
+ * Write every change home, including the running transaction, and unmount the disk so nothing
+ * grouped for commit is lost on shutdown
+ * @return llfs_error or 0 for success
+ */
+llfs_error llfs_unmount() {
+    unwrap(journal_checkpoint());
+    if (disk_journal_is_mounted() && disk_unmount_journal() != 0) return DISK_ERROR;
+    return disk_unmount() == 0 ? 0 : DISK_ERROR;
 }
 
 /**
@@ -1364,28 +3620,77 @@ llfs_error llfs_load() {
  * @return llfs_error or 0 on success
  */
 llfs_error llfs_init() {
+    return llfs_format(JOURNAL_LENGTH);
+}
+
+/**
+ * Format the disk with its journal, either inside the disk where the root directory and the data
+ * blocks follow it or on the journal image where the root directory takes its place
+ * @param journal_length - The number of blocks in the journal, from JOURNAL_LENGTH to JOURNAL_MAX_LENGTH
+ * @param external - Put the journal on the mounted journal image
+ * @return llfs_error or 0 on success
+ */
+static llfs_error llfs_format_with(int journal_length, int external) {
+    if (journal_length < JOURNAL_LENGTH || journal_length > JOURNAL_MAX_LENGTH) return INVALID_OPTION_ERROR;
+    if (external && !disk_journal_is_mounted()) return DISK_ERROR;
     char *buffer = (char *) calloc(BLOCK_SIZE, sizeof(char));
     if (buffer == NULL) return MEMORY_ALLOC_ERROR;
+    root_dir_loc = external ? JOURNAL_LOCATION : JOURNAL_LOCATION + journal_length;
+
+    // The journal comes first so the super block can record the uuid of an external one
+    llfs_error e = journal_init(journal_length, external);
+    if (e != 0) { free(buffer); return e; }
 
     // Super block Config
-    super_block s = { 0x0000, BLOCK_COUNT, ROOT_DIR_LOC, MAX_INODES, 1 };
+    super_block s = { 0x0000, BLOCK_COUNT, root_dir_loc, MAX_INODES, 1, { 0 } };
+    journal_get_uuid(s.journal_uuid);
     memcpy(buffer, &s, sizeof(super_block));
     disk_error de = disk_write_block(SUPER_BLOCK_LOC, buffer);
-    if (de != 0) return DISK_ERROR;
+    if (de != 0) { free(buffer); return DISK_ERROR; }
 
     // Free block bitmap
     memset(free_block_map, 0xFF, BLOCK_SIZE);
-    int blocks[RESERVED_BLOCKS];
-    llfs_error e = llfs_reserve_blocks(blocks, RESERVED_BLOCKS, free_block_map, BLOCK_SIZE);
+    const int reserved = (int) root_dir_loc + 1;
+    int blocks[reserved];
+    e = llfs_reserve_blocks(blocks, reserved, free_block_map, BLOCK_SIZE);
     if (e != 0) { free(buffer); return e;}
 
     de = disk_write_block(FREE_BLOCK_LOC, (char *) free_block_map);
     if (de != 0) return DISK_ERROR;
 
-    unwrap(journal_init());
+    // No block starts out shared
+    memset(block_refs, 0, BLOCK_COUNT);
+    refs_dirty = 0;
+    memset(dcache, 0, sizeof(dcache));
+    memset(icache, 0, sizeof(icache));
+    for (int i = 0; i < REF_COUNT_SIZE; i++) {
+        de = disk_write_block(REF_COUNT_LOC + i, (char *) block_refs + i * BLOCK_SIZE);
+        if (de != 0) return DISK_ERROR;
+    }
+
     unwrap(inode_map_config());
     unwrap(create_root());
 
     free(buffer);
     return 0;
 }
+
+/**
+ * Format the disk with a journal of the given length. The root directory and the data blocks
+ * follow the journal.
+ * @param journal_length - The number of blocks in the journal, from JOURNAL_LENGTH to JOURNAL_MAX_LENGTH
+ * @return llfs_error or 0 on success
+ */
+llfs_error llfs_format(int journal_length) {
+    return llfs_format_with(journal_length, 0);
+}
+
+/**
+ * Format the disk with its journal on the mounted journal image, which is then linked to the
+ * disk by its uuid. The journal's blocks on the disk are left to file data.
+ * @param journal_length - The number of blocks in the journal, from JOURNAL_LENGTH to JOURNAL_MAX_LENGTH
+ * @return llfs_error or 0 on success
+ */
+llfs_error llfs_format_external(int journal_length) {
+    return llfs_format_with(journal_length, 1);
+}
@@ -6,8 +6,10 @@
 #define SYSTEM_INCLUDED
 
 #include <stdint.h>
+#include <pthread.h>
 #include "error.h"
 #include "journal.h"
+#include "File.h"
 
 typedef enum llfs_seek_pos {
     LLFS_SEEK_START,
@@ -15,6 +17,14 @@ typedef enum llfs_seek_pos {
     LLFS_SEEK_SET,
 } llfs_seek_pos;
 
+typedef enum llfs_advice {
+    LLFS_ADV_NORMAL,
+    LLFS_ADV_SEQUENTIAL,
+    LLFS_ADV_RANDOM,
+    LLFS_ADV_WILLNEED,
+    LLFS_ADV_DONTNEED
+} llfs_advice;
+
 typedef enum pos_type {
     DIRECT,
     IND,
@@ -36,21 +46,53 @@ typedef enum file_type {
 
 typedef struct dir_entry {
     uint8_t inode;
-    char name[31]; // Including terminator
+    char name[LLFS_NAME_MAX + 1]; // Including terminator
 } dir_entry;
 
+// Header of a directory entry on disk, the name follows it without a terminator. Entries are
+// packed one after another and rec_len also covers any free space up to the next entry, an entry
+// with a rec_len of 0 reaches to the end of the block. An empty block is a single unused entry.
+typedef struct dir_record {
+    uint16_t rec_len;
+    uint8_t name_len;
+    uint8_t inode;              // 0 for an unused entry
+} dir_record;
+
+// Space taken by an entry with a name of name_len bytes, entries are kept 4 byte aligned
+#define DIR_REC_LEN(name_len) ((sizeof(dir_record) + (name_len) + 3) & ~3u)
+
 typedef struct llfs_inode {
     uint32_t file_size;
     struct {                    // Upgraded this to a bit field instead of int from spec
         unsigned int type : 3;
         unsigned int dir_blocks : 8;
-        unsigned int reserved : 21;
+        unsigned int inline_data : 1;   // File data is stored in the inode block after the inode
+        unsigned int dir_index : 1;     // Directory block 0 is a hashed index of the leaf blocks
+        unsigned int dir_free : 8;      // Blocks of a linear directory before this one are full
+        unsigned int reserved : 11;
     } flags;
     uint16_t direct[10];
     uint16_t indirect;
     uint16_t double_indirect;
 } llfs_inode;
 
+// A cached directory entry, a negative entry records that the name does not exist
+typedef struct dentry {
+    uint32_t parent;        // Inode block of the directory, 0 for an unused slot
+    uint32_t inode_loc;     // Inode block of the file or 0 for a negative entry
+    char name[31];
+} dentry;
+
+// An inode shared by every open file using it. Committed transactions which rewrite the inode
+// block update it and bump the version so that files holding an older copy reload their block map.
+typedef struct inode_ref {
+    uint32_t loc;           // Inode block, 0 for an unused slot or an inode which was freed
+    int refs;               // Number of open files using the inode, only unused inodes are evicted
+    uint32_t version;
+    uint32_t last_used;
+    llfs_inode inode;
+} inode_ref;
+
 typedef struct indirect {
     uint32_t *content;
     file_block *blocks;
@@ -61,6 +103,12 @@ typedef struct double_indirect {
     indirect *blocks;
 } double_indirect;
 
+typedef struct readahead {
+    llfs_advice advice;     // Access pattern hint from llfs_fadvise
+    int next;               // Block index which continues the current sequential stream
+    int window;             // Number of blocks read on the last sequential miss
+} readahead;
+
 typedef struct llfs_file {
     char *loc_pointer;
     int pointer_byte_loc;
@@ -70,36 +118,109 @@ typedef struct llfs_file {
     file_block direct[10];
     indirect ind;
     double_indirect dind;
+    readahead ra;
+    inode_ref *iref;        // Shared inode, NULL when the file has no inode block or the cache is full
+    uint32_t iversion;      // Version of the shared inode the block map was loaded from
 } llfs_file;
 
+// A directory being listed, only the block being read and the indirect block are kept in memory
+typedef struct llfs_dir {
+    int inode_loc;
+    llfs_inode inode;
+    int block;                  // Index of the directory block in block_data
+    int entry;                  // Offset of the next entry to read from block_data
+    uint32_t ind_loc;           // Block the indirect map was read from, 0 if it has not been read
+    uint32_t *ind;
+    char *block_data;
+} llfs_dir;
+
+// A directory waiting to be walked
+typedef struct llfs_walk_item {
+    int inode_loc;
+    char *path;
+} llfs_walk_item;
+
+// The state shared by the worker threads of a tree walk
+typedef struct llfs_walk_state {
+    llfs_walk_fn fn;
+    void *arg;
+    llfs_walk_item *items;      // Stack of directories which have not been walked yet
+    int size;
+    int capacity;
+    int busy;                   // Workers walking a directory, which may queue more
+    llfs_error error;           // First error of any worker, stops the walk
+    pthread_mutex_t lock;       // Guards everything above
+    pthread_cond_t ready;       // Signalled when a directory is queued or the walk ends
+    pthread_mutex_t disk_lock;  // Keeps the reads of the workers from interleaving
+} llfs_walk_state;
+
 typedef struct llfs_write_buffer {
     file_block *blocks;
     int num_blocks;
+    dentry *names;          // Names to cache once the blocks commit, in the order they changed
+    int num_names;
 } llfs_write_buffer;
 
 void llfs_print_file(llfs_file *file);
 void llfs_print_inode(llfs_inode inode);
 
+// Static Block Locations
+extern const uint32_t FREE_BLOCK_LOC;
+extern const uint32_t INODE_MAP_LOC;
+extern const uint32_t REF_COUNT_LOC;
+
 llfs_error llfs_load();
 llfs_error llfs_init();
+llfs_error llfs_format(int journal_length);
+llfs_error llfs_format_external(int journal_length);
 llfs_error llfs_free_file_blocks(llfs_file *f);
 llfs_error llfs_delete(char *path, int recursive);
+llfs_error llfs_sync();
+llfs_error llfs_unmount();
+llfs_error llfs_delete_at(int dir_loc, char *path, int recursive);
 llfs_error llfs_get_pos(int byte, block_pos *p);
 llfs_error free_blocks(int block_num, unsigned char *block_map, int map_size);
 llfs_error llfs_write(char *content, int size, int count, llfs_file *file);
+llfs_error llfs_writev(llfs_iovec *iov, int count, llfs_file *file);
+llfs_error llfs_readv(llfs_iovec *iov, int count, llfs_file *file);
+llfs_error llfs_truncate(llfs_file *file, int new_size);
 llfs_error llfs_open_file(llfs_inode *inode, llfs_file *file, int inode_loc);
+llfs_error llfs_open_inode(llfs_inode *inode, int inode_loc);
 llfs_error llfs_dir_append(llfs_write_buffer *w, llfs_file *f, dir_entry dir);
+llfs_error llfs_search_dir(llfs_file *f, char *next_level, int *inode_block);
+dentry *llfs_dcache_find(uint32_t parent, const char *name);
+void llfs_dcache_set(uint32_t parent, const char *name, uint32_t inode_loc);
+void llfs_dcache_forget(uint32_t inode_loc);
+inode_ref *llfs_icache_find(uint32_t inode_loc);
+llfs_error llfs_dir_open(char *path, llfs_dir *d);
+llfs_error llfs_dir_open_inode(int inode_loc, llfs_dir *d);
+llfs_error llfs_free_tree(int inode_loc, int recursive);
+llfs_error llfs_dir_next(llfs_dir *d, dir_entry *entry, llfs_inode *inode);
+void llfs_dir_close(llfs_dir *d);
 llfs_error llfs_get_bytes(llfs_file *f, char *buffer, int num_bytes, int opt);
 llfs_error llfs_destroy_file(llfs_file *file);
 llfs_error llfs_reserve_inode(uint32_t block_num, uint32_t *imap, int map_size, int *imap_block, int *inode_num);
 llfs_error llfs_seek(llfs_file *f, llfs_seek_pos p, int offset);
+llfs_error llfs_load_block(llfs_file *f, int index);
+llfs_error llfs_advise(llfs_file *f, int offset, int len, llfs_advice advice);
 llfs_error llfs_get_inode(char *path, llfs_inode *inode, int *inode_loc);
+llfs_error llfs_get_inode_at(int dir_loc, char *path, llfs_inode *inode, int *inode_loc);
+llfs_error llfs_open_parent(int dir_loc, char *path, llfs_file *dir, char **name);
 llfs_error llfs_create_file(char *path, file_type t);
+llfs_error llfs_create_many(char *dir_path, char **names, int count, file_type t, int *created);
+llfs_error llfs_create_dirs(char *path);
+llfs_error llfs_create_at(int dir_loc, char *path, file_type t);
+llfs_error llfs_walk_tree(char *root, llfs_walk_fn fn, void *arg, int nthreads);
+llfs_error llfs_clone_file(char *src, char *dst);
+llfs_error llfs_rename_file(char *old_path, char *new_path);
 llfs_error llfs_extend_file(llfs_file *file, llfs_write_buffer *w, int num_blocks, int *blocks);
 llfs_error llfs_reserve_blocks(int *block_nums, int block_count, unsigned char *block_map, int map_size);
 
 llfs_error write_buffer_destroy(llfs_write_buffer *buffer);
+llfs_error write_buffer_inode(llfs_write_buffer *w, llfs_file *f);
 llfs_error write_buffer_any(llfs_write_buffer *w, void *content, int size, int block);
 llfs_error write_buffer_append(llfs_write_buffer *buffer, file_block block);
+llfs_error write_buffer_name(llfs_write_buffer *w, uint32_t parent, const char *name, uint32_t inode_loc);
+llfs_error llfs_commit_ordered(llfs_write_buffer *first, llfs_write_buffer *last);
 
 #endif